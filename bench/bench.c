@@ -0,0 +1,386 @@
+/**
+ * Benchmarks of the shell: how fast a line is parsed, how long a command
+ * takes to spawn, how long a builtin takes to run, how fast data goes
+ * through a pipeline of processes and through one of builtins, what
+ * saving a line in the history costs, how long Tab takes to complete a
+ * command and how fast a pattern is expanded.
+ *
+ * The shell is compiled in, without its main, so the same functions the
+ * shell runs are measured. Each case prints its percentiles, and with -o
+ * one JSON line per case is appended to a file, to compare commits.
+ *
+ * Usage: bench [-n ITERATIONS] [-o FILE] [-l LABEL] [CASE ...]
+ */
+#define SHELL_NO_MAIN
+#include "../shell.c"
+
+// Result of a case: the latency of every iteration, in nanoseconds
+struct benchResult {
+	const char* name;
+	double* samples;
+	int count;
+	double bytes; // data moved by the whole case, for the throughput
+	double seconds; // wall time of the whole case
+};
+
+struct benchCase {
+	const char* name;
+	void (*run)(struct benchResult* result, int iterations);
+	int iterations; // default number of iterations
+};
+
+static const char* benchLabel = "";
+static FILE* benchOutput;
+static char benchDirectory[] = "/tmp/shell-bench-XXXXXX";
+
+/**
+* Method used to get the time of a monotonic clock in nanoseconds
+*/
+static double benchNow(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/**
+* Method used to parse a line the way the main loop does
+*/
+static struct node* benchParse(const char* text) {
+	static char line[4096];
+
+	arenaReset(&lineArena);
+	snprintf(line, sizeof(line), "%s\n", text);
+	if (tokenize(line) <= 0) return NULL;
+	return parseLine(lineTokens);
+}
+
+// Lines parsed by the parse case, with ifs, sequences and redirections
+static const char* parseCorpus[] = {
+	"ls -la /tmp",
+	"cat < input.txt | sort | uniq -c | sort -rn > output.txt",
+	"if test -f a.txt then cat a.txt else echo missing end",
+	"make && ./shell || echo \"build failed\" >> log.txt",
+	"grep -r 'pattern with spaces' src include | wc -l",
+	"if true then if false then echo a else echo b end end ; echo c",
+	"echo one ; echo two ; echo three > /dev/null &",
+	"time find . -name '*.c' | xargs cat | wc -c",
+	"cd /usr/local/share && pwd # a comment at the end",
+	"sleep 1 & jobs ; wait",
+};
+
+/**
+* Case used to measure how many lines are parsed per second
+*/
+static void benchParseLines(struct benchResult* result, int iterations) {
+	int corpusSize = sizeof(parseCorpus) / sizeof(parseCorpus[0]);
+
+	for (int i = 0; i < iterations; i++) {
+		const char* text = parseCorpus[i % corpusSize];
+		double start = benchNow();
+		if (benchParse(text) == NULL) {
+			fprintf(stderr, "bench: parse: cannot parse '%s'\n", text);
+			exit(1);
+		}
+		result->samples[result->count++] = benchNow() - start;
+		result->bytes += strlen(text) + 1;
+	}
+}
+
+/**
+* Case used to measure the spawn of /bin/true and the wait for it
+*/
+static void benchSpawnTrue(struct benchResult* result, int iterations) {
+	for (int i = 0; i < iterations; i++) {
+		struct node* root = benchParse("/bin/true");
+		double start = benchNow();
+		launchProg(&root->pipeline->stages[0], 0);
+		result->samples[result->count++] = benchNow() - start;
+	}
+}
+
+/**
+* Case used to measure a builtin run in the shell, from its tree
+*/
+static void benchBuiltin(struct benchResult* result, int iterations) {
+	for (int i = 0; i < iterations; i++) {
+		struct node* root = benchParse("true");
+		double start = benchNow();
+		executeNode(root);
+		result->samples[result->count++] = benchNow() - start;
+	}
+}
+
+/**
+* Method used to measure the throughput of a pipeline that copies a file
+* through the cat given, three times
+*/
+static void benchCopy(struct benchResult* result, int iterations, const char* cat) {
+	static char block[1 << 20];
+	char path[sizeof(benchDirectory) + 16];
+	char command[sizeof(path) + 64];
+	size_t size = 64 << 20;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/data", benchDirectory);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		perror("bench: pipeline");
+		exit(1);
+	}
+	memset(block, 'x', sizeof(block));
+	for (size_t written = 0; written < size; written += sizeof(block)) {
+		if (write(fd, block, sizeof(block)) != sizeof(block)) {
+			perror("bench: pipeline");
+			exit(1);
+		}
+	}
+	close(fd);
+
+	snprintf(command, sizeof(command), "%s %s | %s | %s > /dev/null", cat, path, cat, cat);
+	for (int i = 0; i < iterations; i++) {
+		struct node* root = benchParse(command);
+		double start = benchNow();
+		pipeHandler(root->pipeline);
+		result->samples[result->count++] = benchNow() - start;
+		result->bytes += size;
+	}
+	unlink(path);
+}
+
+/**
+* Case used to measure the throughput of a pipeline of three processes
+*/
+static void benchPipeline(struct benchResult* result, int iterations) {
+	benchCopy(result, iterations, "/bin/cat");
+}
+
+/**
+* Case used to measure the throughput of a pipeline whose stages are the
+* builtin cat, which moves the data without starting processes
+*/
+static void benchBuiltinPipeline(struct benchResult* result, int iterations) {
+	benchCopy(result, iterations, "cat");
+}
+
+/**
+* Case used to measure what saving a line in the history costs. The log
+* is written in the temporary directory.
+*/
+static void benchHistory(struct benchResult* result, int iterations) {
+	char line[128];
+
+	history.path = malloc(sizeof(benchDirectory) + 16);
+	sprintf(history.path, "%s/history.txt", benchDirectory);
+	if (loadHistory() == -1) exit(1);
+
+	for (int i = 0; i < iterations; i++) {
+		snprintf(line, sizeof(line), "grep -n pattern%d src/file%d.c | sort | head -n %d\n", i, i % 97, i % 13);
+		double start = benchNow();
+		saveHistory(line);
+		result->samples[result->count++] = benchNow() - start;
+		result->bytes += strlen(line);
+	}
+	flushHistory(1);
+	close(history.fd);
+	history.fd = -1;
+	unlink(history.path);
+}
+
+/**
+* Case used to measure Tab on the name of a command, with a directory of
+* 20000 commands in $PATH. The index is built before the first iteration.
+*/
+static void benchComplete(struct benchResult* result, int iterations) {
+	char directory[sizeof(benchDirectory) + 16];
+	char path[sizeof(directory) + 32];
+	char* line = NULL;
+	size_t capacity = 0;
+	int commands = 20000;
+
+	snprintf(directory, sizeof(directory), "%s/bin", benchDirectory);
+	mkdir(directory, 0700);
+	for (int i = 0; i < commands; i++) {
+		snprintf(path, sizeof(path), "%s/cmd%05d", directory, i);
+		close(open(path, O_WRONLY | O_CREAT, 0700));
+	}
+	setVariable("PATH", directory, 1);
+	updatePathIndex();
+
+	editor.line = &line;
+	editor.capacity = &capacity;
+	editor.columns = 80;
+	for (int i = 0; i < iterations; i++) {
+		// Prefixes that match 1000, 100, 10 and 1 commands
+		int length = snprintf(path, sizeof(path), "cmd%05d", (i * 7919) % commands) - 3 + i % 4;
+		growLine(&line, &capacity, length + 64);
+		memcpy(line, path, length);
+		editor.length = editor.cursor = length;
+		double start = benchNow();
+		completeLine(0);
+		result->samples[result->count++] = benchNow() - start;
+		editor.outputLength = 0;
+	}
+
+	for (int i = 0; i < commands; i++) {
+		snprintf(path, sizeof(path), "%s/cmd%05d", directory, i);
+		unlink(path);
+	}
+	rmdir(directory);
+	clearPathIndex();
+	free(line);
+}
+
+/**
+* Case used to measure the expansion of a pattern over a directory of 100000
+* files, with the matches sorted
+*/
+static void benchGlob(struct benchResult* result, int iterations) {
+	char directory[sizeof(benchDirectory) + 16];
+	char path[sizeof(directory) + 32];
+	int files = 100000;
+
+	snprintf(directory, sizeof(directory), "%s/glob", benchDirectory);
+	mkdir(directory, 0700);
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/file%06d.log", directory, i);
+		close(open(path, O_WRONLY | O_CREAT, 0600));
+	}
+
+	snprintf(path, sizeof(path), "true %s/*1.log", directory);
+	for (int i = 0; i < iterations; i++) {
+		struct node* root = benchParse(path);
+		double start = benchNow();
+		struct pipeline* expanded = expandPipeline(root->pipeline);
+		result->samples[result->count++] = benchNow() - start;
+		if (expanded->stages[0].argc != files / 10 + 1) {
+			fprintf(stderr, "bench: glob: %d matches\n", expanded->stages[0].argc - 1);
+			exit(1);
+		}
+	}
+
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/file%06d.log", directory, i);
+		unlink(path);
+	}
+	rmdir(directory);
+}
+
+static const struct benchCase benchCases[] = {
+	{ "parse", benchParseLines, 200000 },
+	{ "spawn", benchSpawnTrue, 2000 },
+	{ "builtin", benchBuiltin, 200000 },
+	{ "pipeline", benchPipeline, 10 },
+	{ "catpipe", benchBuiltinPipeline, 10 },
+	{ "history", benchHistory, 200000 },
+	{ "complete", benchComplete, 200000 },
+	{ "glob", benchGlob, 50 },
+};
+
+static int compareSamples(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+* Method used to get a percentile of the sorted samples
+*/
+static double percentile(struct benchResult* result, double p) {
+	int index = (int)(p / 100 * (result->count - 1) + 0.5);
+
+	return result->samples[index];
+}
+
+/**
+* Method used to print a case, and to write it as a JSON line when an
+* output file is given
+*/
+static void reportResult(struct benchResult* result) {
+	double total = 0;
+
+	qsort(result->samples, result->count, sizeof(double), compareSamples);
+	for (int i = 0; i < result->count; i++) total += result->samples[i];
+
+	printf("%-10s %8d %10.2f %10.2f %10.2f %10.2f %10.2f %12.0f", result->name, result->count,
+		total / result->count / 1e3, percentile(result, 50) / 1e3, percentile(result, 90) / 1e3,
+		percentile(result, 99) / 1e3, result->samples[result->count - 1] / 1e3, result->count / result->seconds);
+	if (result->bytes > 0) printf(" %10.1f", result->bytes / result->seconds / (1 << 20));
+	printf("\n");
+
+	if (benchOutput == NULL) return;
+	fprintf(benchOutput, "{\"label\":\"%s\",\"case\":\"%s\",\"iterations\":%d,\"mean_us\":%.3f,"
+		"\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f,\"ops_per_s\":%.1f,\"mb_per_s\":%.1f}\n",
+		benchLabel, result->name, result->count, total / result->count / 1e3, percentile(result, 50) / 1e3,
+		percentile(result, 90) / 1e3, percentile(result, 99) / 1e3, result->samples[result->count - 1] / 1e3,
+		result->count / result->seconds, result->bytes / result->seconds / (1 << 20));
+}
+
+/**
+* Method used to set up the shell as a script would run it: without the
+* terminal, with the children reaped by the job table
+*/
+static void benchInit(char** envp) {
+	GBSH_PID = getpid();
+	GBSH_PGID = getpgrp();
+	GBSH_IS_INTERACTIVE = 0;
+	initVariables(envp);
+	updateDirectory();
+	initJobs();
+	initLexer();
+	if (mkdtemp(benchDirectory) == NULL) {
+		perror("bench");
+		exit(1);
+	}
+}
+
+int main(int argc, char* argv[], char** envp) {
+	int iterations = 0;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:o:l:")) != -1) {
+		switch (option) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'o':
+			if ((benchOutput = fopen(optarg, "a")) == NULL) {
+				perror(optarg);
+				exit(1);
+			}
+			break;
+		case 'l':
+			benchLabel = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ITERATIONS] [-o FILE] [-l LABEL] [CASE ...]\n", argv[0]);
+			exit(2);
+		}
+	}
+	benchInit(envp);
+
+	printf("%-10s %8s %10s %10s %10s %10s %10s %12s %10s\n", "case", "runs", "mean(us)", "p50(us)", "p90(us)",
+		"p99(us)", "max(us)", "ops/s", "MiB/s");
+	for (size_t c = 0; c < sizeof(benchCases) / sizeof(benchCases[0]); c++) {
+		const struct benchCase* benchCase = &benchCases[c];
+		struct benchResult result = { benchCase->name };
+		int count = iterations > 0 ? iterations : benchCase->iterations;
+		int selected = optind == argc;
+		double start;
+
+		for (int i = optind; i < argc; i++)
+			if (strcmp(argv[i], benchCase->name) == 0) selected = 1;
+		if (!selected) continue;
+
+		result.samples = malloc(count * sizeof(double));
+		start = benchNow();
+		benchCase->run(&result, count);
+		result.seconds = (benchNow() - start) / 1e9;
+		reportResult(&result);
+		fflush(stdout);
+		free(result.samples);
+	}
+	if (benchOutput != NULL) fclose(benchOutput);
+	rmdir(benchDirectory);
+	return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,11 +9,23 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <sys/stat.h>
+#include <spawn.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <pwd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
 #include "shell.h"
 
-#define LIMIT 256 // max number of tokens for a command
-#define MAXLINE 1024 // max number of characters from user input
-
 /**
  * Function used to initialize our shell. We used the approach explained in
  * http://www.gnu.org/software/libc/manual/html_node/Initializing-the-Shell.html
@@ -20,8 +33,13 @@
 void init() {
 	// See if we are running interactively
 	GBSH_PID = getpid();
-	// The shell is interactive if STDIN is the terminal  
-	GBSH_IS_INTERACTIVE = isatty(STDIN_FILENO);
+	// The shell is interactive if STDIN is the terminal and no script
+	// is given, a script runs without the terminal setup
+	GBSH_IS_INTERACTIVE = !scriptInput.active && isatty(STDIN_FILENO);
+
+	// Get the current directory that will be used in different methods,
+	// it is only asked for again after a cd
+	updateDirectory();
 
 	if (GBSH_IS_INTERACTIVE) {
 		// Loop until we are in the foreground
@@ -29,13 +47,22 @@ void init() {
 			kill(GBSH_PID, SIGTTIN);
 
 
-		// Set the signal handlers for SIGCHILD and SIGINT
-		act_child.sa_handler = signalHandler_child;
+		// Set the signal handler for SIGINT
 		act_int.sa_handler = signalHandler_int;
-
-		sigaction(SIGCHLD, &act_child, 0);
 		sigaction(SIGINT, &act_int, 0);
 
+		// The line editor follows the width of the terminal
+		act_winch.sa_handler = signalHandler_winch;
+		act_winch.sa_flags = SA_RESTART;
+		sigaction(SIGWINCH, &act_winch, 0);
+
+		// Ignore the job control signals, so the shell can give the terminal
+		// to a pipeline and take it back when the pipeline is done
+		signal(SIGQUIT, SIG_IGN);
+		signal(SIGTSTP, SIG_IGN);
+		signal(SIGTTIN, SIG_IGN);
+		signal(SIGTTOU, SIG_IGN);
+
 		// Put ourselves in our own process group
 		setpgid(GBSH_PID, GBSH_PID); // we make the shell process the new process group leader
 		GBSH_PGID = getpgrp();
@@ -48,14 +75,10 @@ void init() {
 
 		// Save default terminal attributes for shell
 		tcgetattr(STDIN_FILENO, &GBSH_TMODES);
-
-		// Get the current directory that will be used in different methods
-		currentDirectory = (char*)calloc(1024, sizeof(char));
-	}
-	else {
-		printf("Could not make the shell interactive.\n");
-		exit(EXIT_FAILURE);
 	}
+
+	// The children are reaped from the main loop in both modes
+	initJobs();
 }
 
 void Help(char* args[]) {
@@ -65,673 +88,6119 @@ void Help(char* args[]) {
 		printf("basic: Basic functionalities (3 points)\n");
 		printf("background: Operator & and have processes in the background (0.5 points)\n");
 		printf("spaces: Spaces between commands and parameters (0.5 points)\n");
-		printf("history: Command history (0.5 points)\n");
+		printf("history: Command history, !N runs the entry N again (0.5 points)\n");
 		printf("ctrl + c: Capture and send signals to processes (0.5 points)\n");
+		printf("line editor: Emacs keys to edit the line (Ctrl+A/E/B/F/K/U/W/Y/T/L, Alt+B/F/D), Up and Down or Ctrl+P/N go through the history, Ctrl+R searches it\n");
+		printf("tab: Complete the name of a command or a file, a second Tab lists the names that match\n");
 		printf("if: Conditional expressions (1 points)\n");
 		printf("help: Print a help (1 points)\n");
 		printf("Comandos built-in:\n");
 		printf("cd: Change directories\n");
 		printf("exit: Finish shell\n");
 		printf("help: Show this help\n");
+		printf("spawnstat: Show the spawn latency of external commands\n");
+		printf("hash: Show or remember the location of commands, hash -r forgets them\n");
+		printf("rehash: Forget the location of every command and read the directories of $PATH again for Tab\n");
+		printf("jobs: List the background and stopped jobs, fg, bg and wait take a job as %%N or a pid\n");
+		printf("cat: Write files to the output, tee: copy the input to the output and to files (-a appends), both without copying the data through the shell\n");
+		printf("parallel: Run a command for every argument, as many at a time as there are cores (-j N to change it)\n");
+		printf("export: Give a variable to the commands, NAME=VALUE sets it in the shell and $NAME or ${NAME} use it; unset removes it\n");
+		printf("$(command): Replaced by what the command prints, also written `command`\n");
+		printf("set: Turn shell options on or off, set -o pipefail makes a pipeline fail when any stage fails\n");
+		printf("*, ?, [...], **: Replaced by the paths that match, sorted unless set +o globsort; quoted they stay characters\n");
+		printf("set -o pipesize=SIZE: Give the pipes of the pipelines SIZE bytes, set -o pipestats prints what each pipe moved and how long each stage was blocked\n");
 		printf("if: Perform a conditional operation on a single line \n");
+		printf("trace: Write a JSON line for every command to a file, trace off stops it (also SHELL_TRACE=FILE)\n");
+		printf("time: Written before a pipeline, print the time and resources each stage used\n");
 		printf("Total: 7 points\n");
 	}
 	else {
 		if (args[1] != NULL && args[2] == NULL) {
-			if (strcmp(args[1], "prompt") == 0) printf("Our prompt shows us a list of characters, which make up a list of commands indicating that it is waiting for an order. In our case, where our first line shows the following: <user> @ <host> <cwd>> and then, before each command list we print: my-prompt, letting the user know that our shell. We had no difficulty in performing this functionality or exploiting test cases\n");
+			if (strcmp(args[1], "prompt") == 0) printf("Our prompt shows us a list of characters, which make up a list of commands indicating that it is waiting for an order. In our case it shows the following: <user>@<host> <cwd> >, letting the user know that our shell is waiting. The prompt is kept and only built again after a cd or when the host name changes, which the kernel tells by waking a poll on /proc/sys/kernel/hostname\n");
 			else if (strcmp(args[1], "cd") == 0) printf("This command allows you to change the current address, it is very easy, since the chdir function does all the work. In the event that the address that is passed as a parameter is null, it sets x default home, and in case it is not valid, it will print that that address is not found. or we had no difficulty in performing this functionality or cases of tests that exploit\n");
 			else if (strcmp(args[1], "<") == 0) printf("We implement this command to redirect the standard input/output of commands to/from files with >/</>>, for this we use \"open\" and \"close\". The open function returns an integer that identifies a descriptor and It has as parameters a pointer to the path of the file that we want to open and some flags that indicate how to open it: read only, write only, read / write or others. The \"close\" function closes the file descriptor that we pass as a parameter. Returns 0 on success and -1 on failure. Then we use the \"setenv\" function to define a new environment variable or change the existing one. Three arguments are required, the first and second of which are char pointers pointing to the variable name and its value, respectively. The third argument is of type int and specifies whether the value of the given variable should be overwritten if it already exists in the environment. The non-zero value of this argument denotes the overwrite behavior and the zero value the opposite.\n");
 			else if (strcmp(args[1], "pipe") == 0) printf("A pipeline consists of a chain of processes connected in such a way that the output of each element in the chain is the input of the next. They allow communication and synchronization between processes. The use of data buffer between consecutive elements is common. To implement these we use\n");
-			else if (strcmp(args[1], "history") == 0) printf("Our history consists of saving in a txt, which we save in the local folder where the project is located, all the commands that are executed listed and separated by line changes. To do this command, we use the functions fopen, fread and fwrite, With fopen we open the file, and if it does not exist it creates it, where the first parameter is the name of the file and the second is the mode, in this case we use \"a\" since it allows adding texti at the end of the file without replacing the previous text, and then with fwrite and fread to write and read the file respectively.\n");
+			else if (strcmp(args[1], "history") == 0) printf("Our history is saved in a txt in the folder where the shell was started, one numbered command per line. The file is only appended to: the commands are written through a buffer which is flushed to the disk at most every second. When the shell starts, the file is mapped in memory once to find where every command starts, and the last commands are kept in memory, so 'history' and '!N' do not read the whole file again. '!!' runs the last command and '!-N' the Nth before. When the file grows too much, only its last commands are kept.\n");
 			else if (strcmp(args[1], "ctrl+c") == 0) printf("The ctrl + c functionality consists in that when this combination of keys is touched, the current process is not destroyed, but it is executed again if the prompt is killed. To do this we create the methods \"signalHandler_child\" and \"signalHandler_int\"; in which if when killing the process it returns 0, we change the variable that controls whether we should make a prompt or not.\n");
 			else if (strcmp(args[1], "help") == 0) printf("This functionality shows us how to use the commands, and in case of only using the help without another command, it shows the functionalities implemented\n");
 		}
 	}
 }
 
-void saveHistory(char* line) {
-	FILE * fichero = fopen(historyFileName, "a");
-    if(!fichero){
-        perror("fopen");
-        exit(EXIT_FAILURE);
-    }
-	char * stringToSave = strcat(buffer,historyCount);
-	strcat(stringToSave, " ");
-	strcat(stringToSave, line);
-    fwrite(stringToSave,1,strlen(stringToSave), fichero);
-	fwrite("\n", 1, strlen("\n"), fichero);
-    fclose(fichero);
-	exit(EXIT_SUCCESS);
-}
-
-char* loadHistory() {
-	FILE* inputFile = fopen(historyFileName, "rb+");
-    if(!inputFile) exit(EXIT_FAILURE);
-	struct stat sb;
-	if(stat(historyFileName, &sb) == -1){
-		perror("stat");
-		exit(EXIT_FAILURE);
-	}
-	char * loadHistory = malloc(sb.st_size);
-	fread(loadHistory, sb.st_size, 1, inputFile);
-	//printf("%s\n", loadHistory);
-	actualHistory = strcat(buffer,loadHistory);
-	fclose(inputFile);
-	free(loadHistory);
-	return actualHistory;
+/**
+ * HISTORY
+ */
+
+/**
+* Method used to find where the command starts in a line of the history
+* log, which is written as "NUMBER COMMAND"
+*/
+const char* historyText(const char* line, const char* end) {
+	const char* text = line;
+
+	while (text < end && *text >= '0' && *text <= '9') text++;
+	if (text < end && *text == ' ' && text > line) return text + 1;
+	return line;
 }
 
-char* again(int line) {
-	int i = 0;
-	int j = 0;
-	int count = 1;
-	char * againCommand;
-	while (i < strlen(actualHistory))
-	{
-		if(actualHistory[i] == "\n"){
-			if(line == count) return againCommand;
-			j = 0;
-			againCommand = "";
-			count++;
-		}
-		againCommand[j] = actualHistory[i];
-		i++;
-		j++;
-	}
+/**
+* Method used to remember an entry in the ring of recent entries
+*/
+void rememberHistory(const char* text, size_t length) {
+	char** slot = &history.ring[history.count % HISTORY_RING_SIZE];
+	char* entry = realloc(*slot, length + 1);
+
+	if (entry == NULL) return;
+	memcpy(entry, text, length);
+	entry[length] = '\0';
+	*slot = entry;
 }
 
 /**
- * SIGNAL HANDLERS
- */
+* Method used to add the offset of one more entry of the log to the index
+*/
+int indexHistory(off_t offset) {
+	if (history.count == history.capacity) {
+		int capacity = history.capacity == 0 ? 1024 : history.capacity * 2;
+		off_t* offsets = realloc(history.offsets, capacity * sizeof(off_t));
 
- /**
-  * signal handler for SIGCHLD
-  */
-void signalHandler_child(int p) {
-	/* Wait for all dead processes.
-	 * We use a non-blocking call (WNOHANG) to be sure this signal handler will not
-	 * block if a child was cleaned up in another part of the program. */
-	while (waitpid(-1, NULL, WNOHANG) > 0) {
+		if (offsets == NULL) return -1;
+		history.offsets = offsets;
+		history.capacity = capacity;
 	}
-	printf("\n");
+	history.offsets[history.count] = offset;
+	return 0;
 }
 
 /**
- * Signal handler for SIGINT
- */
-void signalHandler_int(int p) {
-	// We send a SIGTERM signal to the child process
-	if (kill(pid, SIGTERM) == 0) {
-		printf("\nProcess %d received a SIGINT signal\n", pid);
-		no_reprint_prmpt = 1;
-	}
-	else {
-		printf("\n");
+* Method used to write the pending entries to the log. With sync they are
+* also flushed to the disk.
+*/
+void flushHistory(int sync) {
+	size_t written = 0;
+
+	while (history.fd != -1 && written < history.pendingLength) {
+		ssize_t n = write(history.fd, history.pending + written, history.pendingLength - written);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		written += n;
 	}
+	history.pendingLength = 0;
+	history.flushedSize = history.size;
+	if (sync && history.fd != -1) fdatasync(history.fd);
+	history.lastSync = time(NULL);
 }
 
 /**
- *	Displays the prompt for the shell
- */
-void shellPrompt() {
-	// We print the prompt in the form "<user>@<host> <cwd> >"
-	char hostn[1204] = "";
-	gethostname(hostn, sizeof(hostn));
-	printf("myprompt $ ");
+* Method used to flush the history when the shell ends. The forked children
+* do not flush the entries of their parent.
+*/
+void closeHistory(void) {
+	if (getpid() == GBSH_PID && history.pendingLength > 0) flushHistory(1);
 }
 
 /**
- * Method to change directory
- */
-int changeDirectory(char* args[]) {
-	// If we write no path (only 'cd'), then go to the home directory
-	if (args[1] == NULL) {
-		chdir(getenv("HOME"));
-		return 1;
+* Method used to load the history log. The file is mapped once to build
+* the index of offsets and to fill the ring with the last entries. A log
+* bigger than HISTORY_MAX_SIZE is compacted first, and the log compaction
+* left is loaded as it is.
+*/
+int loadHistory(void) {
+	struct stat sb;
+	char* map = NULL;
+	const char* line;
+	const char* end;
+	int first;
+
+	if (history.path == NULL) {
+		// The log stays in the same place when the shell changes directory
+		if (historyFileName[0] != '/' && currentDirectory != NULL) {
+			history.path = malloc(strlen(currentDirectory) + strlen(historyFileName) + 2);
+			if (history.path != NULL) sprintf(history.path, "%s/%s", currentDirectory, historyFileName);
+		}
+		if (history.path == NULL) history.path = strdup(historyFileName);
+		atexit(closeHistory);
 	}
-	// Else we change the directory to the one specified by the 
-	// argument, if possible
-	else {
-		if (chdir(args[1]) == -1) {
-			printf(" %s: no such directory\n", args[1]);
+
+	for (int i = 0; i < HISTORY_RING_SIZE; i++) {
+		free(history.ring[i]);
+		history.ring[i] = NULL;
+	}
+	history.count = 0;
+	history.size = 0;
+	history.pendingLength = 0;
+	history.lastSync = time(NULL);
+	if (history.fd != -1) close(history.fd);
+
+	history.fd = open(history.path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (history.fd == -1 || fstat(history.fd, &sb) == -1) {
+		perror("history");
+		return -1;
+	}
+	if (sb.st_size > HISTORY_MAX_SIZE && !history.compacting) return compactHistory();
+
+	if (sb.st_size > 0) {
+		map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, history.fd, 0);
+		if (map == MAP_FAILED) {
+			perror("history");
 			return -1;
 		}
+		madvise(map, sb.st_size, MADV_SEQUENTIAL);
+	}
+
+	// A line is one entry, the last one may not be terminated
+	for (line = map; line < map + sb.st_size; line = end + 1) {
+		end = memchr(line, '\n', map + sb.st_size - line);
+		if (end == NULL) end = map + sb.st_size;
+		if (indexHistory(line - map) == -1) break;
+		history.count++;
+	}
+
+	// Only the last entries are copied to the ring
+	first = history.count > HISTORY_RING_SIZE ? history.count - HISTORY_RING_SIZE : 0;
+	for (int i = first; i < history.count; i++) {
+		off_t next = i + 1 < history.count ? history.offsets[i + 1] : sb.st_size;
+		const char* text = historyText(map + history.offsets[i], map + next);
+		int count = history.count;
+
+		history.count = i;
+		rememberHistory(text, map + next - text);
+		history.count = count;
+	}
+	if (map != NULL) munmap(map, sb.st_size);
+
+	history.size = history.flushedSize = sb.st_size;
+	// A log that was cut in the middle of a line gets its end back
+	if (sb.st_size > 0 && history.ring[(history.count - 1) % HISTORY_RING_SIZE] != NULL) {
+		char* last = history.ring[(history.count - 1) % HISTORY_RING_SIZE];
+		if (last[0] == '\0' || last[strlen(last) - 1] != '\n') {
+			history.pending[history.pendingLength++] = '\n';
+			history.size++;
+		}
 	}
 	return 0;
 }
 
 /**
-* Method for launching a program. It can be run in the background
-* or in the foreground
+* Method used to rewrite the log with its last entries, numbered again from
+* 1: at most HISTORY_KEEP of them and HISTORY_KEEP_SIZE bytes, so the log
+* has room to grow again before the next compaction. The new log is
+* written aside and renamed over the old one, so the history is never lost
+* half way.
 */
-void launchProg(char** args, int background) {
-	int err = -1;
+int compactHistory(void) {
+	char* temporary = malloc(strlen(history.path) + 5);
+	struct stat sb;
+	char* map;
+	FILE* output;
+	int number = 0;
 
-	if ((pid = fork()) == -1) {
-		printf("Child process could not be created\n");
-		return;
+	flushHistory(0);
+	if (temporary == NULL || fstat(history.fd, &sb) == -1) {
+		free(temporary);
+		return -1;
 	}
-	// pid == 0 implies the following code is related to the child process
-	if (pid == 0) {
-		// We set the child to ignore SIGINT signals (we want the parent
-		// process to handle them with signalHandler_int)	
-		signal(SIGINT, SIG_IGN);
-
-		setenv("parent", getcwd(currentDirectory, 1024), 1);
+	sprintf(temporary, "%s.tmp", history.path);
 
-		// If we launch non-existing commands we end the process
-		if (execvp(args[0], args) == err) {
-			printf("Command not found");
-			kill(getpid(), SIGTERM);
-		}
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, history.fd, 0);
+	if (map == MAP_FAILED || (output = fopen(temporary, "w")) == NULL) {
+		perror("history");
+		if (map != MAP_FAILED) munmap(map, sb.st_size);
+		free(temporary);
+		return -1;
 	}
 
-	// The following will be executed by the parent
+	// We count the lines from the end to find the first one that is kept
+	const char* start = map + sb.st_size;
+	if (start > map && start[-1] == '\n') start--;
+	for (int kept = 0; start > map; start--) {
+		if (start[-1] == '\n' && (map + sb.st_size - start > HISTORY_KEEP_SIZE || ++kept == HISTORY_KEEP)) break;
+	}
+	// The entry that goes over the size that is kept is left out
+	if (map + sb.st_size - start > HISTORY_KEEP_SIZE) {
+		const char* next = memchr(start, '\n', map + sb.st_size - start);
+		start = next != NULL ? next + 1 : map + sb.st_size;
+	}
+	for (const char* line = start; line < map + sb.st_size;) {
+		const char* end = memchr(line, '\n', map + sb.st_size - line);
+		const char* text;
 
-	// If the process is not requested to be in background, we wait for
-	// the child to finish.
-	if (background == 0) {
-		waitpid(pid, NULL, 0);
+		if (end == NULL) end = map + sb.st_size;
+		text = historyText(line, end);
+		fprintf(output, "%d %.*s\n", ++number, (int)(end - text), text);
+		line = end + 1;
 	}
-	else {
-		// In order to create a background process, the current process
-		// should just skip the call to wait. The SIGCHILD handler
-		// signalHandler_child will take care of the returning values
-		// of the childs.
-		printf("Process created with PID: %d\n", pid);
+	munmap(map, sb.st_size);
+
+	if (fclose(output) != 0 || rename(temporary, history.path) == -1) {
+		perror("history");
+		unlink(temporary);
+		free(temporary);
+		return -1;
 	}
+	free(temporary);
+	// The entries are numbered again, so the search index is rebuilt
+	clearHistoryIndex();
+	history.compacting = 1;
+	number = loadHistory();
+	history.compacting = 0;
+	return number;
 }
 
 /**
-* Method used to manage I/O redirection
+* Method used to save a line in the history. It is remembered in the ring
+* and appended to the log through a buffer, which is written when it is
+* full and flushed to the disk at most every HISTORY_SYNC_INTERVAL seconds.
 */
-void fileIO(char* args[], char* inputFile, char* outputFile, int option) {
-	int err = -1;
+void saveHistory(char* line) {
+	size_t length = strlen(line);
+	size_t room;
+	int n;
 
-	int fileDescriptor; // between 0 and 19, describing the output or input file
+	if (length == 0) return;
+	if (indexHistory(history.size) == -1) return;
+	rememberHistory(line, length);
+	history.count++;
+	if (historyIndex.built) indexHistoryEntry(line, length);
 
-	if ((pid = fork()) == -1) {
-		printf("Child process could not be created\n");
-		return;
+	room = sizeof(history.pending) - history.pendingLength;
+	n = snprintf(history.pending + history.pendingLength, room, "%d %s%s", history.count, line,
+		line[length - 1] == '\n' ? "" : "\n");
+	if (n >= (int)room) {
+		// A line that does not fit in the buffer is written on its own
+		flushHistory(0);
+		if (history.fd != -1) dprintf(history.fd, "%d %s%s", history.count, line, line[length - 1] == '\n' ? "" : "\n");
 	}
-	if (pid == 0) {
-		// outputFile not empty: output redirection
-		if (strcmp(outputFile, "") != 0) {
-			// option 0: truncate operation
-			if (option == 0) {
-				// We open (create) the file truncating it at 0, for write only
-				fileDescriptor = open(outputFile, O_CREAT | O_TRUNC | O_WRONLY, 0600);
-			}
-			// option 1: append operation
-			if (option == 1) {
-				// We open (create) the file truncating it at 0, for write only
-				fileDescriptor = open(outputFile, O_CREAT | O_APPEND | O_WRONLY, 0600);
-			}
-			// We replace de standard output with the appropriate file
-			dup2(fileDescriptor, STDOUT_FILENO);
-			close(fileDescriptor);
+	else history.pendingLength += n;
+	history.size += n;
+
+	if (time(NULL) - history.lastSync >= HISTORY_SYNC_INTERVAL) flushHistory(1);
+	if (history.size > HISTORY_MAX_SIZE) compactHistory();
+}
+
+/**
+* Method used to get the entry number of the history, without its line
+* break. The recent ones are in the ring, the others are read from the log
+* at their offset. It returns NULL when there is no such entry.
+*/
+char* recallHistory(int number) {
+	static char* entry;
+	static size_t entryCapacity;
+	off_t offset, next;
+	ssize_t length;
+	const char* text;
+
+	if (number < 1 || number > history.count) return NULL;
+	if (number > history.count - HISTORY_RING_SIZE) text = history.ring[(number - 1) % HISTORY_RING_SIZE];
+	else {
+		offset = history.offsets[number - 1];
+		next = history.offsets[number];
+		if (next > history.flushedSize) flushHistory(0);
+		if ((size_t)(next - offset) + 1 > entryCapacity) {
+			char* grown = realloc(entry, next - offset + 1);
+			if (grown == NULL) return NULL;
+			entry = grown;
+			entryCapacity = next - offset + 1;
 		}
-		// inputFile not empty: input redirection
-		if (strcmp(inputFile, "") != 0) {
-			// We open file for read only (it's STDIN)
-			fileDescriptor = open(inputFile, O_RDONLY, 0600);
-			// We replace de standard input with the appropriate file
-			dup2(fileDescriptor, STDIN_FILENO);
-			close(fileDescriptor);
+		if ((length = pread(history.fd, entry, next - offset, offset)) <= 0) return NULL;
+		entry[length] = '\0';
+		text = historyText(entry, entry + length);
+	}
+	if (text == NULL) return NULL;
+	length = strlen(text);
+	while (length > 0 && text[length - 1] == '\n') length--;
+	// The caller gets a copy that stays valid until the next recall
+	if (text != entry) {
+		if ((size_t)length + 1 > entryCapacity) {
+			char* grown = realloc(entry, length + 1);
+			if (grown == NULL) return NULL;
+			entry = grown;
+			entryCapacity = length + 1;
 		}
+		memcpy(entry, text, length);
+	}
+	else memmove(entry, text, length);
+	entry[length] = '\0';
+	return entry;
+}
+
+/**
+* Method used to replace an event at the start of the line, '!N', '!-N' or
+* '!!', by the entry of the history it names. The rest of the line is kept.
+* It returns -1 when the event does not exist.
+*/
+int expandHistory(char** line, size_t* capacity) {
+	char* rest;
+	char* entry;
+	long number;
+	size_t length, restOffset;
 
-		setenv("parent", getcwd(currentDirectory, 1024), 1);
+	if ((*line)[0] != '!') return 0;
+	if ((*line)[1] == '!') {
+		number = history.count;
+		restOffset = 2;
+	}
+	else {
+		number = strtol(*line + 1, &rest, 10);
+		restOffset = rest - *line;
+		if (restOffset == 1) return 0;
+		if (number < 0) number += history.count + 1;
+	}
 
-		if (execvp(args[0], args) == err) {
-			printf("err");
-			kill(getpid(), SIGTERM);
-		}
+	if ((entry = recallHistory(number)) == NULL) {
+		fprintf(stderr, "%.*s: event not found\n", (int)restOffset, *line);
+		return -1;
 	}
-	waitpid(pid, NULL, 0);
+	rest = *line + restOffset;
+	length = strlen(entry) + strlen(rest) + 1;
+	if (length > *capacity) {
+		char* grown = realloc(*line, length);
+		if (grown == NULL) return -1;
+		*line = grown;
+		*capacity = length;
+	}
+	rest = *line + restOffset;
+	memmove(*line + strlen(entry), rest, strlen(rest) + 1);
+	memcpy(*line, entry, strlen(entry));
+	// Like other shells we show the command that is executed
+	printf("%s", *line);
+	return 0;
 }
 
 /**
- * Method to get the redirection input and output
+* Method used to spread the trigrams over the buckets of the index
 */
-void getRedirection(char* commandList[], char** directionI, char** directionO, int index, int* option) {
-	char* newInput = (char*)malloc(sizeof(char));
-	char* newOutput = (char*)malloc(sizeof(char));
-	int currentI = 0; // to know if is output or input
-	int pos = index;
-	while (commandList[pos] != NULL) {
-		if (strcmp(commandList[pos], ">") == 0) {
-			newOutput = NULL;
-			free(newOutput);
-			newOutput = (char*)malloc(sizeof(char));
-			currentI = 1;
-			*option = 0;
-		}
+unsigned int trigramHash(unsigned int trigram) {
+	return (trigram * 2654435761u) >> (32 - historyIndex.tableBits);
+}
 
-		else if (strcmp(commandList[pos], ">>") == 0) {
-			newOutput = NULL;
-			free(newOutput);
-			newOutput = (char*)malloc(sizeof(char));
-			currentI = 1;
-			*option = 1;
-		}
+/**
+* Method used to find the entries that contain a trigram. With create, a
+* trigram that is not in the index yet gets an empty list.
+*/
+struct trigramPosting* findTrigram(unsigned int trigram, int create) {
+	struct trigramPosting* posting;
+	unsigned int bucket = trigramHash(trigram);
 
-		else if (strcmp(commandList[pos], "<") == 0) {
-			newInput = NULL;
-			free(newInput);
-			newInput = (char*)malloc(sizeof(char));
-			currentI = 0;
-		}
+	for (posting = historyIndex.table[bucket]; posting != NULL; posting = posting->next)
+		if (posting->trigram == trigram) return posting;
+	if (!create) return NULL;
 
-		else if (currentI == 0) {
-			newInput = strcat(newInput, commandList[pos]);
-			if (commandList[pos + 1] != NULL && strcmp(commandList[pos], "<") != 0 &&
-				strcmp(commandList[pos], ">") == 0 && strcmp(commandList[pos], ">>") == 0)
-				newInput = strcat(newInput, " ");
-		}
+	// The table doubles when it is three quarters full, like the command table
+	if (historyIndex.tableCount >= (3 << historyIndex.tableBits) / 4) {
+		int size = 1 << historyIndex.tableBits;
+		struct trigramPosting** old = historyIndex.table;
+		struct trigramPosting** table = calloc(size * 2, sizeof(struct trigramPosting*));
 
-		else {
-			newOutput = strcat(newOutput, commandList[pos]);
-			if (commandList[pos + 1] != NULL && strcmp(commandList[pos], "<") != 0 &&
-				strcmp(commandList[pos], ">") == 0 && strcmp(commandList[pos], ">>") == 0)
-				newOutput = strcat(newOutput, " ");
+		if (table != NULL) {
+			historyIndex.table = table;
+			historyIndex.tableBits++;
+			for (int i = 0; i < size; i++) {
+				while (old[i] != NULL) {
+					struct trigramPosting* next = old[i]->next;
+					bucket = trigramHash(old[i]->trigram);
+					old[i]->next = table[bucket];
+					table[bucket] = old[i];
+					old[i] = next;
+				}
+			}
+			free(old);
+			bucket = trigramHash(trigram);
 		}
-		pos++;
 	}
-	*directionI = newInput;
-	*directionO = newOutput;
+
+	if ((posting = calloc(1, sizeof(struct trigramPosting))) == NULL) return NULL;
+	posting->trigram = trigram;
+	posting->next = historyIndex.table[bucket];
+	historyIndex.table[bucket] = posting;
+	historyIndex.tableCount++;
+	return posting;
 }
 
 /**
-* Method used to handle the commands entered via the standard input after being splited by pipeHandler
+* Method used to add the next entry of the history to the index: its text
+* is copied and its number is added to the list of each of its trigrams
 */
-int commandHandler(char* args[]) {
-	int i = 0;
-	int j = 0;
+void indexHistoryEntry(const char* text, size_t length) {
+	int number = historyIndex.count + 1;
 
-	int fileDescriptor;
-	int standardOut;
+	while (length > 0 && text[length - 1] == '\n') length--;
 
-	int aux;
-	int background = 0;
+	if (historyIndex.count == historyIndex.capacity) {
+		int capacity = historyIndex.capacity == 0 ? 1024 : historyIndex.capacity * 2;
+		size_t* offsets = realloc(historyIndex.offsets, capacity * sizeof(size_t));
+		if (offsets == NULL) return;
+		historyIndex.offsets = offsets;
+		historyIndex.capacity = capacity;
+	}
+	if (historyIndex.textLength + length + 1 > historyIndex.textCapacity) {
+		size_t capacity = historyIndex.textCapacity == 0 ? 65536 : historyIndex.textCapacity;
+		while (capacity < historyIndex.textLength + length + 1) capacity *= 2;
+		char* grown = realloc(historyIndex.text, capacity);
+		if (grown == NULL) return;
+		historyIndex.text = grown;
+		historyIndex.textCapacity = capacity;
+	}
+	historyIndex.offsets[historyIndex.count++] = historyIndex.textLength;
+	memcpy(historyIndex.text + historyIndex.textLength, text, length);
+	historyIndex.text[historyIndex.textLength + length] = '\0';
+	historyIndex.textLength += length + 1;
 
-	char* args_aux[256];
+	for (size_t i = 0; i + 3 <= length; i++) {
+		unsigned int trigram = (unsigned char)text[i] << 16 | (unsigned char)text[i + 1] << 8 | (unsigned char)text[i + 2];
+		struct trigramPosting* posting = findTrigram(trigram, 1);
 
-	// We look for the special characters and separate the command itself
-	// in a new array for the arguments
-	while (args[j] != NULL) {
-		if ((strcmp(args[j], ">") == 0) || (strcmp(args[j], "<") == 0) || (strcmp(args[j], "&") == 0) ||
-			(strcmp(args[j], ">>") == 0)) {
-			break;
+		// An entry is listed once, even if the trigram repeats in it
+		if (posting == NULL || (posting->count > 0 && posting->entries[posting->count - 1] == number)) continue;
+		if (posting->count == posting->capacity) {
+			int capacity = posting->capacity == 0 ? 4 : posting->capacity * 2;
+			int* entries = realloc(posting->entries, capacity * sizeof(int));
+			if (entries == NULL) continue;
+			posting->entries = entries;
+			posting->capacity = capacity;
 		}
-		args_aux[j] = args[j];
-		j++;
-	}
-	// 'exit' command quits the shell
-	if (strcmp(args[0], "exit") == 0) exit(0);
-	// 'pwd' command prints the current directory
-	else if (strcmp(args[0], "pwd") == 0) {
-		if (args[j] != NULL) {
-			// If we want file output
-			if ((strcmp(args[j], ">") == 0) && (args[j + 1] != NULL)) {
-				fileDescriptor = open(args[j + 1], O_CREAT | O_TRUNC | O_WRONLY, 0600);
-				// We replace de standard output with the appropriate file
-				standardOut = dup(STDOUT_FILENO); 	// first we make a copy of stdout
-													// because we'll want it back
-				dup2(fileDescriptor, STDOUT_FILENO);
-				close(fileDescriptor);
-				printf("%s\n", getcwd(currentDirectory, 1024));
-				dup2(standardOut, STDOUT_FILENO);
-			}
-		}
-		else {
-			printf("%s\n", getcwd(currentDirectory, 1024));
+		posting->entries[posting->count++] = number;
+	}
+}
+
+/**
+* Method used to forget the index, which is built again when it is needed
+*/
+void clearHistoryIndex(void) {
+	for (int i = 0; historyIndex.table != NULL && i < 1 << historyIndex.tableBits; i++) {
+		while (historyIndex.table[i] != NULL) {
+			struct trigramPosting* next = historyIndex.table[i]->next;
+			free(historyIndex.table[i]->entries);
+			free(historyIndex.table[i]);
+			historyIndex.table[i] = next;
 		}
 	}
-	// 'true' command clears the screen
-	else if (strcmp(args[0], "true") == 0) return 0;
-	// 'false' comando
-	else if (strcmp(args[0], "false") == 0) return 1;
-	// help
-	else if (strcmp(args[0], "help") == 0) {
-		Help(args);
-		return 0;
+	free(historyIndex.table);
+	free(historyIndex.text);
+	free(historyIndex.offsets);
+	memset(&historyIndex, 0, sizeof(historyIndex));
+}
+
+/**
+* Method used to build the index the first time the history is searched.
+* The log is mapped once and every entry of it is indexed; from then on
+* saveHistory keeps the index up to date.
+*/
+int buildHistoryIndex(void) {
+	char* map = NULL;
+	struct stat sb;
+
+	if (historyIndex.built) return 0;
+	historyIndex.tableBits = 12;
+	if ((historyIndex.table = calloc(1 << historyIndex.tableBits, sizeof(struct trigramPosting*))) == NULL) return -1;
+	historyIndex.built = 1;
+
+	flushHistory(0);
+	if (history.fd != -1 && fstat(history.fd, &sb) == 0 && sb.st_size > 0) {
+		map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, history.fd, 0);
+		if (map == MAP_FAILED) map = NULL;
 	}
-	// history
-	else if (strcmp(args[0], "history") == 0) {
-		printf("%s\n", loadHistory());
-		return 0;
+	for (int i = 0; map != NULL && i < history.count; i++) {
+		off_t next = i + 1 < history.count ? history.offsets[i + 1] : sb.st_size;
+		const char* text;
+
+		if (next > sb.st_size) break;
+		text = historyText(map + history.offsets[i], map + next);
+		indexHistoryEntry(text, map + next - text);
 	}
-	// 'cd' command to change directory
-	else if (strcmp(args[0], "cd") == 0) changeDirectory(args);
-	else {
-		// If none of the preceding commands were used, we invoke the
-		// specified program. We have to detect if I/O redirection,
-		// piped execution or background execution were solicited
-		while (args[i] != NULL && background == 0) {
-			// If background execution was solicited (last argument '&')
-			// we exit the loop
-			if (strcmp(args[i], "&") == 0) {
-				background = 1;
-				// If '|' is detected, piping was solicited, and we call
-				// the appropriate method that will handle the different
-				// executions
-			}
-			else if (strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0 ||
-				strcmp(args[i], ">>") == 0) {
-				char* directionO;
-				char* directionI;
-				int option;
-				getRedirection(args, &directionI, &directionO, i, &option);
-				args_aux[i] = NULL;
-				fileIO(args_aux, directionI, directionO, option);
-				directionI = NULL;
-				directionO = NULL;
-				free(directionI);
-				free(directionO);
-				return 0;
-			}
-			i++;
-		}
-		// We launch the program with our method, indicating if we
-		// want background execution or not
-		args_aux[i] = NULL;
-		launchProg(args_aux, background);
+	if (map != NULL) munmap(map, sb.st_size);
+
+	// The entries the log could not give are taken from the ring
+	while (historyIndex.count < history.count) {
+		char* entry = recallHistory(historyIndex.count + 1);
+		indexHistoryEntry(entry != NULL ? entry : "", entry != NULL ? strlen(entry) : 0);
 	}
-	return 1;
+	return 0;
 }
 
 /**
-* Method used to manage pipes and split the commands.
+* Method used to get the text of an entry of the index
 */
-int pipeHandler(char* args[]) {
-	//TODO: Poner esto mas bonito
-	//Para continuar revisando desde donde me quede cuando la llamada venga de un pipe
-	int current = 0;
-	//Para saber si algun metodo me devuelve -1
-	int correctOutput = 0;
-	//Para guardar los file descriptors de STDIN y STDOUT cuando haga falta
-	int fd;
-	//Para ir guardando los pedazos de comandos separados por pipes
-	char* newCommandLine[LIMIT];
-
-	int pipes;
-	int pipefd[2];
+const char* indexedEntry(int number) {
+	return historyIndex.text + historyIndex.offsets[number - 1];
+}
 
-	//Dentro del while me encargo de los caracteres especiales
-	while (args[current] != NULL)
-	{
-		if (strcmp(args[current], "|") == 0) {
-			pipes = 1;
-			//Terminar con NULL el array que contiene el comando que se va a ejecutar antes del caracter especial
-			newCommandLine[current] = NULL;
-
-			//Crear el pipe (lee de la izquierda y escribe en la derecha)
-			pipe(pipefd);
-
-			//Ejecuta el comando que escribe en el pipe
-			int child2Pid = fork();
-			if (child2Pid == 0) {
-				//Remplaza la salida actual por el fd de escritura del pipe
-				dup2(pipefd[1], STDOUT_FILENO);
-				close(pipefd[0]);
-				close(pipefd[1]);
+/**
+* Method used to find the most recent entry of the history before the
+* entry number before that contains query. With a query of three or more
+* characters only the entries listed for its rarest trigram are checked.
+* It returns the number of the entry, or 0 when none matches.
+*/
+int searchHistory(const char* query, int before) {
+	size_t length = strlen(query);
+	struct trigramPosting* rarest = NULL;
 
-				//Ejecuta el comando que estaba antes del pipe
-				correctOutput = commandHandler(newCommandLine);
-				exit(correctOutput);
-			}
-			//Espera a que se ejecute el primer comando
-			waitpid(child2Pid, NULL, 0);
+	if (length == 0 || buildHistoryIndex() == -1) return 0;
+	if (before > historyIndex.count + 1) before = historyIndex.count + 1;
 
-			//Cierra el fd de escritura(si esto no se hace aqui el comando que lee se queda esperando mas input)
-			close(pipefd[1]);
+	if (length < 3) {
+		for (int number = before - 1; number >= 1; number--)
+			if (strstr(historyIndex.text + historyIndex.offsets[number - 1], query) != NULL) return number;
+		return 0;
+	}
 
-			break;
-		}
-		else {
-			newCommandLine[current] = args[current];
-		}
-		current++;
-	}
-	if (pipes == 1) {
-		// printf("entre pipe");
-		current++;
-		int current1 = 0;
-		char* newCommandLine1[LIMIT];
-		while (args[current] != NULL)
-		{
-			newCommandLine1[current1] = args[current];
-			current1++;
-			current++;
-		}
-
-		//A current le resto startPos por si no empece a revisar desde el principio de args 
-		newCommandLine[current1] = NULL;
-
-		//Ejecuta el comando que escribe en el pipe
-		int childPid = fork();
-		if (childPid == 0) {
-			//Remplaza la salida actual por el fd de escritura del pipe
-			dup2(pipefd[0], STDIN_FILENO);
-			close(pipefd[0]);
-			close(pipefd[1]);
+	for (size_t i = 0; i + 3 <= length; i++) {
+		unsigned int trigram = (unsigned char)query[i] << 16 | (unsigned char)query[i + 1] << 8 | (unsigned char)query[i + 2];
+		struct trigramPosting* posting = findTrigram(trigram, 0);
 
-			//Ejecuta el comando que estaba antes del pipe
-			correctOutput = commandHandler(newCommandLine1);
-			exit(correctOutput);
-		}
-		//Espera a que se ejecute el primer comando
-		waitpid(childPid, NULL, 0);
+		// A trigram that no entry has means nothing can match
+		if (posting == NULL) return 0;
+		if (rarest == NULL || posting->count < rarest->count) rarest = posting;
+	}
 
-		//Cierra el fd de escritura(si esto no se hace aqui el comando que lee se queda esperando mas input)
-		close(pipefd[0]);
+	// The list is sorted, so we start from the last entry before the limit
+	int low = 0, high = rarest->count;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (rarest->entries[middle] < before) low = middle + 1;
+		else high = middle;
 	}
-	else
-	{
-		newCommandLine[current] = NULL;
-		//Llegados a este punto el comando actual no tiene caracteres especiales asi que lo ejecuto
-		return commandHandler(newCommandLine);
+	for (int i = low - 1; i >= 0; i--) {
+		int number = rarest->entries[i];
+		if (strstr(historyIndex.text + historyIndex.offsets[number - 1], query) != NULL) return number;
 	}
+	return 0;
 }
 
+/**
+ * SIGNAL HANDLERS
+ */
+
+ /**
+  * signal handler for SIGCHLD
+  */
+void signalHandler_child(int p) {
+	int savedErrno = errno;
 
+	// The children are reaped by the shell when it reads the pipe, the
+	// handler only wakes it up. The pipe does not block when it is full.
+	write(selfPipe[1], "", 1);
+	errno = savedErrno;
+}
 
 /**
-* Main method of our shell
-*/
-int main(int argc, char* argv[], char** envp) {
-	char line[MAXLINE]; // buffer for the user input
-	char* prevTokens[LIMIT]; // array for the different tokens in the command
-	int numTokens;
+ * Signal handler for SIGINT
+ */
+void signalHandler_int(int p) {
+	// The foreground job gets the SIGINT from the terminal by itself, the
+	// line reader drops the line being written
+	lineInterrupted = 1;
+	write(STDOUT_FILENO, "\n", 1);
+}
 
-	no_reprint_prmpt = 0; 	// to prevent the printing of the shell
-							// after certain methods
-	pid = -10; // we initialize pid to an pid that is not possible
+/**
+ * Signal handler for SIGWINCH
+ */
+void signalHandler_winch(int p) {
+	// The line editor reads the width again before it draws the next key
+	windowResized = 1;
+}
 
-	// We call the method of initialization and the welcome screen
-	init();
+/**
+* Method used to know if the host name changed since the prompt was built,
+* without reading it: the kernel wakes a poll on the file when it changes
+*/
+int hostnameChanged(void) {
+	struct pollfd fd = { prompt.hostnameFd, POLLPRI | POLLERR, 0 };
 
-	// We set our extern char** environ to the environment, so that
-	// we can treat it later in other methods
-	environ = envp;
+	if (prompt.hostnameFd == -1) return 0;
+	// The poll reports a change once, the next one waits for another
+	return poll(&fd, 1, 0) > 0 && (fd.revents & (POLLPRI | POLLERR));
+}
 
-	setenv("shell", getcwd(currentDirectory, 1024), 1);
+/**
+* Method used to build the prompt from the user, the host name and the
+* current directory
+*/
+void buildPrompt(void) {
+	const char* user = getVariable("LOGNAME");
+	struct passwd* account;
+	int length;
 
-	// Main loop, where the user input will be read and the prompt
-	// will be printed
-	while (TRUE) {
-		// We print the shell prompt if necessary
-		if (no_reprint_prmpt == 0) shellPrompt();
-		no_reprint_prmpt = 0;
-
-		// We empty the line buffer
-		memset(line, '\0', MAXLINE);
-
-		// We wait for user input
-		fgets(line, MAXLINE, stdin);
-		// printf("%s\n", line);
-
-		// Save the line in history
-		if (strcmp(line[0], " ") != 0)
-			saveHistory(line);
-
-		// If nothing is written, the loop is executed again
-		if ((prevTokens[0] = strtok(line, " \n")) == NULL) continue;
-
-		// We read all the tokens of the input and pass it to our
-		// commandHandler as the argument
-		numTokens = 1;
-		while ((prevTokens[numTokens] = strtok(NULL, " \n")) != NULL) numTokens++;
-		// printf("%i tokens\n", numTokens);
-		char* tokens[MAXLINE];
-
-		// Verificar si existe # para ignorar el resto del comando
-		int lastToken = 0;
-		for (int i = 0; i < numTokens && strcmp(prevTokens[i], "#") != 0; i++)
-		{
-			tokens[i] = prevTokens[i];
-			lastToken++;
-		}
-		tokens[lastToken] = NULL;
-
-		if (tokens[0] != NULL) {
-			if (tokens[1] != NULL && tokens[2] == NULL) {
-				// line = again((int)tokens[1]);
-				// If nothing is written, the loop is executed again
-				if ((prevTokens[0] = strtok(line, " \n")) == NULL) continue;
-
-				// We read all the tokens of the input and pass it to our
-				// commandHandler as the argument
-				numTokens = 1;
-				while ((prevTokens[numTokens] = strtok(NULL, " \n")) != NULL) numTokens++;
-				// printf("%i tokens\n", numTokens);
-				char* tokens[MAXLINE];
-
-				// Verificar si existe # para ignorar el resto del comando
-				int lastToken = 0;
-				for (int i = 0; i < numTokens && strcmp(prevTokens[i], "#") != 0; i++)
-				{
-					tokens[i] = prevTokens[i];
-					lastToken++;
-				}
-				tokens[lastToken] = NULL;
-			}
-		}
-
-		// Se manejan las condiciones
-		if (strcmp(tokens[0], "if") == 0)
-		{
-			// Se verifica que aparezcan solo un if, then, un posible else y end
-			// y en orden correcto
-			int startToken = 1;
-			int rightOrder = 0;
-			int elseExist = 0;
-			int countSyntax = 1;
-			// comando entre el if y el then
-			while (tokens[startToken] != NULL && rightOrder == 0)
-			{
-				if (strcmp(tokens[startToken], "if") == 0 || strcmp(tokens[startToken], "end") == 0
-					|| strcmp(tokens[startToken], "else") == 0)
-					rightOrder = 1;
-				if (strcmp(tokens[startToken], "then") == 0) {
-					countSyntax++;
-					startToken++;
-					break;
-				}
-				startToken++;
-			}
-
-			// comando entre el then y un posible else o end
-			while (tokens[startToken] != NULL && rightOrder == 0)
-			{
-				if (strcmp(tokens[startToken], "if") == 0 || strcmp(tokens[startToken], "then") == 0)
-					rightOrder = 1;
-				if (strcmp(tokens[startToken], "else") == 0 || strcmp(tokens[startToken], "end") == 0) {
-					if (strcmp(tokens[startToken], "else") == 0)
-						elseExist = 1;
-					countSyntax++;
-					startToken++;
-					break;
-				}
-				startToken++;
-			}
-
-			// comando entre un then o un posible end y un end
-			while (tokens[startToken] != NULL && rightOrder == 0)
-			{
-				if (strcmp(tokens[startToken], "if") == 0 || strcmp(tokens[startToken], "then") == 0 ||
-					strcmp(tokens[startToken], "else") == 0)
-					rightOrder = 1;
-				if (strcmp(tokens[startToken], "end") == 0) {
-					countSyntax++;
-					startToken++;
-					break;
-				}
-				startToken++;
-			}
-
-			// Si cumple todas las condiciones entonces se ejecutan los comandos
-			// sino entonces no es un comando if
-			if (rightOrder == 0 &&
-				(elseExist == 0 && countSyntax == 3 || elseExist == 1 && countSyntax == 4)) {
-				// Primero el comando dentro del if
-				startToken = 1;
-				char* tokensCondition[LIMIT];
-				while (tokens[startToken] != NULL && strcmp(tokens[startToken], "then") != 0) {
-					tokensCondition[startToken - 1] = tokens[startToken];
-					startToken++;
-				}
-				// Si dentro del if el comando esta vacio, ignora la linea
-				if (tokens[startToken] == NULL) continue;
-				tokensCondition[startToken - 1] = NULL;
-				if (tokensCondition[0] == NULL) continue;
-				startToken++;
-
-				int command = pipeHandler(tokensCondition);
-
-				// Si se cumple entra al then y vuelve a realizar lo mismo
-				// sino entra al else y repite lo mismo
-				if (command == 0) {
-					char* tokensThen[LIMIT];
-					int startThen = 0;
-					while (tokens[startToken] != NULL && strcmp(tokens[startToken], "else") != 0 &&
-						strcmp(tokens[startToken], "end") != 0)
-					{
-						tokensThen[startThen] = tokens[startToken];
-						startThen++;
-						startToken++;
-					}
-					if (tokens[startToken] == NULL) continue;
-					tokensThen[startThen] = NULL;
-					if (tokensThen[0] == NULL) continue;
+	if (user == NULL) user = getVariable("USER");
+	if (user == NULL && (account = getpwuid(getuid())) != NULL) user = account->pw_name;
+	if (prompt.hostnameFd == -1) prompt.hostnameFd = open("/proc/sys/kernel/hostname", O_RDONLY | O_CLOEXEC);
+	if (gethostname(prompt.hostname, sizeof(prompt.hostname)) == -1) prompt.hostname[0] = '\0';
+	prompt.hostname[sizeof(prompt.hostname) - 1] = '\0';
 
-					pipeHandler(tokensThen);
-				}
-				else
-				{
-					while (tokens[startToken] != NULL && strcmp(tokens[startToken], "else") != 0)
-						startToken++;
-					startToken++;
-					char* tokensElse[LIMIT];
-					int startElse = 0;
-					// printf("%i\n", command);
-					while (tokens[startToken] != NULL && strcmp(tokens[startToken], "end") != 0)
-					{
-						tokensElse[startElse] = tokens[startToken];
-						startElse++;
-						startToken++;
-					}
-					if (tokens[startToken] == NULL) continue;
-					tokensElse[startElse] = NULL;
-					if (tokensElse[0] == NULL) continue;
+	free(prompt.text);
+	length = asprintf(&prompt.text, "%s@%s %s > ", user != NULL ? user : "", prompt.hostname,
+		currentDirectory != NULL ? currentDirectory : "");
+	if (length == -1) {
+		prompt.text = NULL;
+		prompt.length = 0;
+		return;
+	}
+	prompt.length = length;
+	prompt.columns = textColumns(prompt.text, prompt.length);
+	prompt.dirty = 0;
+}
 
-					pipeHandler(tokensElse);
-				}
-			}
+/**
+ *	Displays the prompt for the shell
+ */
+void shellPrompt() {
+	// We print the prompt in the form "<user>@<host> <cwd> >", built again
+	// only after a cd or when the host name changed
+	if (prompt.dirty || hostnameChanged()) buildPrompt();
+	if (prompt.text != NULL) fwrite(prompt.text, 1, prompt.length, stdout);
+}
+
+/**
+ * Method to change directory
+ */
+int changeDirectory(char* args[]) {
+	// If we write no path (only 'cd'), then go to the home directory
+	if (args[1] == NULL) {
+		const char* home = getVariable("HOME");
+		if (home == NULL || chdir(home) == -1) return 1;
+		updateDirectory();
+		return 0;
+	}
+	// Else we change the directory to the one specified by the 
+	// argument, if possible
+	else {
+		if (chdir(args[1]) == -1) {
+			printf(" %s: no such directory\n", args[1]);
+			return 1;
 		}
+		updateDirectory();
+	}
+	return 0;
+}
+
+/**
+ * ARENA
+ */
+
+/**
+* Method used to take size bytes from an arena. The memory lives until the
+* arena is reset; chunks are only requested from malloc when the ones the
+* arena already has are full, so after the first lines no command needs the
+* heap.
+*/
+void* arenaAlloc(struct arena* arena, size_t size) {
+	struct arenaChunk* chunk = arena->current;
+
+	// Every allocation keeps the alignment of a pointer
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+	while (chunk != NULL && chunk->used + size > chunk->size) {
+		// The next chunk was used by a previous line, it is empty now
+		if (chunk->next != NULL) chunk->next->used = 0;
+		chunk = chunk->next;
+	}
+	if (chunk == NULL) {
+		size_t chunkSize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		chunk = malloc(sizeof(struct arenaChunk) + chunkSize);
+		chunk->size = chunkSize;
+		chunk->used = 0;
+		chunk->next = NULL;
+		if (arena->current == NULL) arena->first = chunk;
 		else {
-			pipeHandler(tokens);
+			// The new chunk goes after the current one, before the
+			// chunks that were too small for this allocation
+			chunk->next = arena->current->next;
+			arena->current->next = chunk;
 		}
 	}
+	arena->current = chunk;
+
+	void* memory = chunk->data + chunk->used;
+	chunk->used += size;
+	return memory;
+}
+
+/**
+* Method used to copy a string into an arena
+*/
+char* arenaStrdup(struct arena* arena, const char* string) {
+	size_t length = strlen(string) + 1;
+	return memcpy(arenaAlloc(arena, length), string, length);
+}
+
+/**
+* Method used to release everything taken from an arena at once. The chunks
+* are kept to be reused.
+*/
+void arenaReset(struct arena* arena) {
+	arena->current = arena->first;
+	if (arena->first != NULL) arena->first->used = 0;
+}
+
+/**
+ * LEXER
+ */
+
+/**
+* Method used to fill the table of character classes used by the lexer
+*/
+void initLexer() {
+	const char* spaces = " \t\n\r";
+	const char* operators = "|&;<>";
+	const char* quotes = "'\"\\`";
+
+	for (const char* c = spaces; *c != '\0'; c++) charClass[(unsigned char)*c] |= CHAR_SPACE;
+	for (const char* c = operators; *c != '\0'; c++) charClass[(unsigned char)*c] |= CHAR_OPERATOR;
+	for (const char* c = quotes; *c != '\0'; c++) charClass[(unsigned char)*c] |= CHAR_QUOTE;
+	charClass['$'] |= CHAR_DOLLAR;
+	for (const char* c = "*?["; *c != '\0'; c++) charClass[(unsigned char)*c] |= CHAR_GLOB;
+	for (const char* c = EXPANSION_MARKERS; *c != '\0'; c++) charClass[(unsigned char)*c] |= CHAR_MARKER;
+	charClass[0] = CHAR_END;
+}
+
+/**
+* Method used to know if a token is an operator produced by the lexer. The
+* operators are recognized by their address, so a quoted "|" is a word.
+*/
+int isOperator(const char* token) {
+	return token >= operatorTokens[0] && token < (char*)(operatorTokens + OPERATOR_COUNT);
+}
+
+/**
+* Method used to read the operator that starts with c, followed by next.
+* It returns the interned token and stores how many characters it uses.
+*/
+char* lexOperator(char c, char next, int* length) {
+	*length = 1;
+	switch (c) {
+	case '|':
+		if (next == '|') {
+			*length = 2;
+			return TOKEN_OR;
+		}
+		return TOKEN_PIPE;
+	case '&':
+		if (next == '&') {
+			*length = 2;
+			return TOKEN_AND;
+		}
+		return TOKEN_BACKGROUND;
+	case ';':
+		return TOKEN_SEMICOLON;
+	case '<':
+		return TOKEN_INPUT;
+	default:
+		if (next == '>') {
+			*length = 2;
+			return TOKEN_APPEND;
+		}
+		return TOKEN_OUTPUT;
+	}
+}
+
+/**
+* Method used to append a token to the token list of the line, growing it
+* when it is full
+*/
+void addToken(char* token) {
+	if (lineTokensCount + 1 >= lineTokensCapacity) {
+		char** grown;
+		lineTokensCapacity = lineTokensCapacity == 0 ? 64 : lineTokensCapacity * 2;
+		grown = arenaAlloc(&lineArena, lineTokensCapacity * sizeof(char*));
+		memcpy(grown, lineTokens, lineTokensCount * sizeof(char*));
+		lineTokens = grown;
+	}
+	lineTokens[lineTokensCount++] = token;
+	lineTokens[lineTokensCount] = NULL;
+}
+
+/**
+* Method used to split a line into tokens in a single pass. Words are
+* slices of the line itself: quotes and backslashes are removed by moving
+* the characters back inside the line, and a '\0' is written where each
+* word ends. Operators and keywords are the interned tokens of shell.h, and
+* each '$' that starts an expansion is replaced by a marker.
+* A word starting with '#' begins a comment. The tokens are left in
+* lineTokens, allocated in the line arena, and the method returns their number or -1 if a quote is not
+* closed.
+*/
+int tokenize(char* line) {
+	unsigned char* src = (unsigned char*)line;
+	unsigned char* dst;
+	unsigned char c;
+	int length;
+
+	// The list lives in the line arena and always ends with NULL, also
+	// when the line is empty
+	lineTokens = NULL;
+	lineTokensCapacity = 0;
+	lineTokensCount = 0;
+	addToken(NULL);
+	lineTokensCount = 0;
+	lineExpansions = 0;
+
+	while (TRUE) {
+		// Spaces between the tokens
+		while (charClass[*src] & CHAR_SPACE) src++;
+		c = *src;
+		if (c == '\0' || c == '#') break;
+
+		if (charClass[c] & CHAR_OPERATOR) {
+			addToken(lexOperator(c, src[1], &length));
+			src += length;
+			continue;
+		}
+
+		// A word: the plain characters are skipped with the class table,
+		// and only moved when a quote was removed before them
+		char* start = (char*)src;
+		int quoted = 0;
+		dst = src;
+		while (TRUE) {
+			if (dst == src)
+				while (!(charClass[*src] & CHAR_DELIMITER)) src++, dst++;
+			else
+				while (!(charClass[*src] & CHAR_DELIMITER)) *dst++ = *src++;
+
+			c = *src;
+			if (c == '\'') {
+				quoted = 1;
+				src++;
+				while (*src != '\'' && *src != '\0') *dst++ = *src++;
+				if (*src == '\0') {
+					fprintf(stderr, "syntax error: unterminated quote\n");
+					return -1;
+				}
+				src++;
+			}
+			else if (c == '"') {
+				quoted = 1;
+				src++;
+				while (*src != '"' && *src != '\0') {
+					// Inside double quotes a backslash only escapes these
+					if (*src == '\\' && src[1] != '\0' && strchr("\"\\$`\n", src[1]) != NULL) src++;
+					else if (*src == '$' && src[1] == '(') {
+						if ((src = lexSubstitution(src + 2, &dst, SUBSTITUTION_QUOTED_MARKER, ')')) == NULL) return -1;
+						continue;
+					}
+					else if (*src == '`') {
+						if ((src = lexSubstitution(src + 1, &dst, SUBSTITUTION_QUOTED_MARKER, '`')) == NULL) return -1;
+						continue;
+					}
+					// An expansion inside quotes is never split
+					else if (*src == '$' && startsExpansion(src[1])) {
+						*dst++ = EXPAND_QUOTED_MARKER;
+						src++;
+						lineExpansions++;
+						continue;
+					}
+					*dst++ = *src++;
+				}
+				if (*src == '\0') {
+					fprintf(stderr, "syntax error: unterminated quote\n");
+					return -1;
+				}
+				src++;
+			}
+			else if (c == '$' && src[1] == '(') {
+				if ((src = lexSubstitution(src + 2, &dst, SUBSTITUTION_MARKER, ')')) == NULL) return -1;
+			}
+			else if (c == '`') {
+				if ((src = lexSubstitution(src + 1, &dst, SUBSTITUTION_MARKER, '`')) == NULL) return -1;
+			}
+			else if (c == '$') {
+				// The '$' that start an expansion are marked, so a quoted
+				// or escaped '$' stays a character
+				src++;
+				if (startsExpansion(*src)) {
+					*dst++ = EXPAND_MARKER;
+					lineExpansions++;
+					// The '?' of $? or ${?} is a name, not a pattern
+					if (*src == '{' && (src[1] == '?' || src[1] == '$' || src[1] == '!')) *dst++ = *src++;
+					if (*src == '?' || *src == '$' || *src == '!') *dst++ = *src++;
+				}
+				else *dst++ = '$';
+			}
+			else if (charClass[c] & CHAR_GLOB) {
+				// The pattern characters are marked too, so a quoted or
+				// escaped '*' stays a character
+				*dst++ = c == '*' ? GLOB_STAR : c == '?' ? GLOB_ANY : GLOB_SET;
+				src++;
+				lineExpansions++;
+			}
+			else if (c == '\\') {
+				quoted = 1;
+				src++;
+				// A backslash before the newline joins the lines
+				if (*src == '\n') src++;
+				else if (*src != '\0') *dst++ = *src++;
+			}
+			else break;
+		}
+
+		// c ends the word. It is saved before the '\0' is written because
+		// the end of the word may be the same position.
+		*dst = '\0';
+		addToken(quoted ? start : internKeyword(start, (char*)dst - start));
+
+		if (c == '\0') break;
+		if (charClass[c] & CHAR_SPACE) src++;
+		else {
+			addToken(lexOperator(c, src[1], &length));
+			src += length;
+		}
+	}
+	return lineTokensCount;
+}
+
+/**
+* Method used to copy a command substitution into its word. The command is
+* kept as it was written, between the marker and SUBSTITUTION_END, to be
+* tokenized when the word is expanded. $( ends at the ')' that
+* matches it, out of quotes; a backtick at the next one that is not
+* escaped. It returns where the substitution ends in the line, or NULL if
+* it is not closed.
+*/
+unsigned char* lexSubstitution(unsigned char* src, unsigned char** dst, char marker, char close) {
+	int depth = 0;
+	char quote = 0;
+
+	*(*dst)++ = marker;
+	while (*src != '\0') {
+		char c = *src;
+		if (close == '`') {
+			if (c == '`') break;
+			if (c == '\\' && (src[1] == '`' || src[1] == '\\' || src[1] == '$')) c = *++src;
+		}
+		else if (quote != 0) {
+			if (c == quote) quote = 0;
+			else if (c == '\\' && quote == '"' && src[1] != '\0') {
+				*(*dst)++ = c;
+				c = *++src;
+			}
+		}
+		else if (c == '\'' || c == '"') quote = c;
+		// The escaped character is copied as it is
+		else if (c == '\\' && src[1] != '\0') {
+			*(*dst)++ = c;
+			c = *++src;
+		}
+		else if (c == '(') depth++;
+		else if (c == ')' && depth-- == 0) break;
+		*(*dst)++ = c;
+		src++;
+	}
+	if (*src == '\0') {
+		fprintf(stderr, "syntax error: unterminated command substitution\n");
+		return NULL;
+	}
+	*(*dst)++ = SUBSTITUTION_END;
+	lineExpansions++;
+	return src + 1;
+}
+
+/**
+* Method used to replace an unquoted word by its interned keyword, if it is
+* one, so the parser can recognize it by its address
+*/
+char* internKeyword(char* word, int length) {
+	if (length < 2 || length > 4) return word;
+	for (int i = 0; i < KEYWORD_COUNT; i++)
+		if (strcmp(word, keywordTokens[i]) == 0) return keywordTokens[i];
+	return word;
+}
+
+/**
+ * PARSER
+ */
+
+/**
+* Method used to report a syntax error at the current token of the parser
+*/
+void syntaxError(struct parser* parser) {
+	char* token = parser->tokens[parser->position];
+
+	if (!parser->error)
+		fprintf(stderr, "syntax error near unexpected token `%s'\n", token == NULL ? "newline" : token);
+	parser->error = 1;
+}
+
+/**
+* Method used to allocate a node of the command tree in the line arena
+*/
+struct node* newNode(int type, struct node* left, struct node* right) {
+	struct node* node = arenaAlloc(&lineArena, sizeof(struct node));
+
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	node->elseBranch = NULL;
+	node->pipeline = NULL;
+	return node;
+}
+
+/**
+* Method used to know if a token closes the list of an if: then, else or
+* end. Outside an if they are ordinary words.
+*/
+int closesList(struct parser* parser, char* token) {
+	return parser->depth > 0 && (token == TOKEN_THEN || token == TOKEN_ELSE || token == TOKEN_END);
+}
+
+/**
+* Method used to parse the redirection at the current token into the list
+* that ends at *last
+*/
+int parseRedirection(struct parser* parser, struct redirection*** last) {
+	struct redirection* redirection;
+	int type = redirectionType(parser->tokens[parser->position]);
+	char* file = parser->tokens[parser->position + 1];
+
+	parser->position++;
+	if (file == NULL || isOperator(file)) {
+		syntaxError(parser);
+		return -1;
+	}
+	redirection = arenaAlloc(&lineArena, sizeof(struct redirection));
+	redirection->type = type;
+	redirection->file = file;
+	redirection->next = NULL;
+	**last = redirection;
+	*last = &redirection->next;
+	parser->position++;
+	return 0;
+}
+
+/**
+* Method used to parse one command of a pipeline: a simple command with its
+* words and redirections, or an if clause followed by redirections
+*/
+int parseCommand(struct parser* parser, struct command* command) {
+	struct redirection** last = &command->redirections;
+	char** tokens = parser->tokens;
+	int words = 0;
+	int assignments = 0;
+	int i;
+
+	command->redirections = NULL;
+	command->compound = NULL;
+	command->argc = 0;
+	command->argv = NULL;
+	command->assignments = NULL;
+	command->assignmentCount = 0;
+
+	if (tokens[parser->position] == TOKEN_IF) {
+		if ((command->compound = parseIf(parser)) == NULL) return -1;
+		while (redirectionType(tokens[parser->position]) != REDIRECT_NONE)
+			if (parseRedirection(parser, &last) == -1) return -1;
+		return 0;
+	}
+	if (tokens[parser->position] == TOKEN_THEN || tokens[parser->position] == TOKEN_ELSE ||
+		tokens[parser->position] == TOKEN_END) {
+		syntaxError(parser);
+		return -1;
+	}
+
+	// The words are counted first, so the argument vector is allocated once.
+	// The assignments are the words before the command name.
+	for (i = parser->position; tokens[i] != NULL && !closesList(parser, tokens[i]); i++) {
+		if (redirectionType(tokens[i]) != REDIRECT_NONE) {
+			if (tokens[i + 1] != NULL) i++;
+		}
+		else if (isOperator(tokens[i])) break;
+		else if (words == 0 && isAssignment(tokens[i])) assignments++;
+		else words++;
+	}
+	command->argv = arenaAlloc(&lineArena, (words + 1) * sizeof(char*));
+	if (assignments > 0) {
+		command->assignments = arenaAlloc(&lineArena, (assignments + 1) * sizeof(char*));
+		command->assignments[assignments] = NULL;
+	}
+
+	while (tokens[parser->position] != NULL && !closesList(parser, tokens[parser->position])) {
+		char* token = tokens[parser->position];
+		if (redirectionType(token) != REDIRECT_NONE) {
+			if (parseRedirection(parser, &last) == -1) return -1;
+		}
+		else if (isOperator(token)) break;
+		else {
+			if (command->argc == 0 && command->assignmentCount < assignments)
+				command->assignments[command->assignmentCount++] = token;
+			else command->argv[command->argc++] = token;
+			parser->position++;
+		}
+	}
+	command->argv[command->argc] = NULL;
+
+	if (command->argc == 0 && command->redirections == NULL && command->assignmentCount == 0) {
+		syntaxError(parser);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+* Method used to parse the commands separated by '|'
+*/
+struct node* parsePipeline(struct parser* parser) {
+	struct pipeline* pipeline = arenaAlloc(&lineArena, sizeof(struct pipeline));
+	int capacity = 4;
+
+	pipeline->stages = arenaAlloc(&lineArena, capacity * sizeof(struct command));
+	pipeline->count = 0;
+	pipeline->background = 0;
+	pipeline->timed = 0;
+
+	// 'time' before a pipeline measures all its stages
+	if (parser->tokens[parser->position] == TOKEN_TIME) {
+		pipeline->timed = 1;
+		parser->position++;
+	}
+
+	while (TRUE) {
+		if (pipeline->count == capacity) {
+			struct command* grown = arenaAlloc(&lineArena, 2 * capacity * sizeof(struct command));
+			memcpy(grown, pipeline->stages, capacity * sizeof(struct command));
+			pipeline->stages = grown;
+			capacity *= 2;
+		}
+		if (parseCommand(parser, &pipeline->stages[pipeline->count]) == -1) return NULL;
+		pipeline->count++;
+
+		if (parser->tokens[parser->position] != TOKEN_PIPE) break;
+		parser->position++;
+	}
+
+	struct node* node = newNode(NODE_PIPELINE, NULL, NULL);
+	node->pipeline = pipeline;
+	return node;
+}
+
+/**
+* Method used to parse pipelines joined by '&&' and '||'. Both operators
+* have the same precedence and group from the left.
+*/
+struct node* parseAndOr(struct parser* parser) {
+	struct node* node = parsePipeline(parser);
+
+	while (node != NULL) {
+		char* token = parser->tokens[parser->position];
+		if (token != TOKEN_AND && token != TOKEN_OR) break;
+		parser->position++;
+
+		struct node* right = parsePipeline(parser);
+		if (right == NULL) return NULL;
+		node = newNode(token == TOKEN_AND ? NODE_AND : NODE_OR, node, right);
+	}
+	return node;
+}
+
+/**
+* Method used to parse a list: and-or lists separated by ';' or '&'. A
+* list ends with the line, or with then, else or end inside an if. An
+* empty list gives NULL without an error.
+*/
+struct node* parseList(struct parser* parser) {
+	struct node* list = NULL;
+
+	while (!parser->error) {
+		char* token = parser->tokens[parser->position];
+		if (token == NULL || closesList(parser, token)) break;
+
+		struct node* item = parseAndOr(parser);
+		if (item == NULL) return NULL;
+
+		token = parser->tokens[parser->position];
+		if (token == TOKEN_BACKGROUND) {
+			// A pipeline goes to the background by itself, anything else
+			// needs a subshell
+			if (item->type == NODE_PIPELINE) item->pipeline->background = 1;
+			else item = newNode(NODE_BACKGROUND, item, NULL);
+			parser->position++;
+		}
+		else if (token == TOKEN_SEMICOLON) parser->position++;
+		else if (token != NULL && !closesList(parser, token)) {
+			syntaxError(parser);
+			return NULL;
+		}
+
+		list = list == NULL ? item : newNode(NODE_SEQUENCE, list, item);
+	}
+	return parser->error ? NULL : list;
+}
+
+/**
+* Method used to parse 'if list then list [else list] end'. Ifs can be
+* nested in any of the lists.
+*/
+struct node* parseIf(struct parser* parser) {
+	struct node* node = newNode(NODE_IF, NULL, NULL);
+
+	parser->position++;
+	parser->depth++;
+
+	node->left = parseList(parser);
+	if (node->left == NULL || parser->tokens[parser->position] != TOKEN_THEN) {
+		syntaxError(parser);
+		return NULL;
+	}
+	parser->position++;
+
+	node->right = parseList(parser);
+	if (parser->error) return NULL;
+	if (parser->tokens[parser->position] == TOKEN_ELSE) {
+		parser->position++;
+		node->elseBranch = parseList(parser);
+		if (parser->error) return NULL;
+	}
+	if (parser->tokens[parser->position] != TOKEN_END) {
+		syntaxError(parser);
+		return NULL;
+	}
+	parser->position++;
+	parser->depth--;
+	return node;
+}
+
+/**
+* Method used to parse the NULL terminated tokens of a line into a command
+* tree allocated in the line arena. Parsing is recursive descent and reads
+* every token once. It returns NULL for an empty line or a syntax error,
+* which is reported.
+*/
+struct node* parseLine(char** tokens) {
+	struct parser parser = { tokens, 0, 0, 0 };
+	struct node* root = parseList(&parser);
+
+	if (!parser.error && tokens[parser.position] != NULL) syntaxError(&parser);
+	return parser.error ? NULL : root;
+}
+
+/**
+ * COMMAND HASH TABLE
+ */
+
+/**
+* FNV-1a hash of a string, used by the hash tables of the shell
+*/
+unsigned int hashString(const char* string) {
+	unsigned int hash = 2166136261u;
+
+	while (*string != '\0') {
+		hash ^= (unsigned char)*string++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+* Method used to forget every remembered command location
+*/
+void clearCommandTable() {
+	for (int i = 0; i < commandTableSize; i++) {
+		struct commandEntry* entry = commandTable[i];
+		while (entry != NULL) {
+			struct commandEntry* next = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			entry = next;
+		}
+		commandTable[i] = NULL;
+	}
+	commandTableCount = 0;
+}
+
+/**
+* Method used to remove the location of one command from the table
+*/
+void forgetCommand(const char* name) {
+	if (commandTableSize == 0) return;
+
+	struct commandEntry** link = &commandTable[hashString(name) & (commandTableSize - 1)];
+	while (*link != NULL) {
+		if (strcmp((*link)->name, name) == 0) {
+			struct commandEntry* entry = *link;
+			*link = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			commandTableCount--;
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+/**
+* Method used to look for an executable in the directories of $PATH, the same
+* way execvp does. It returns a malloc'ed absolute path or NULL.
+*/
+char* searchPath(const char* name) {
+	const char* path = getVariable("PATH");
+	size_t nameLength = strlen(name);
+	struct stat sb;
+
+	if (path == NULL) path = "/usr/local/bin:/usr/bin:/bin";
+	while (TRUE) {
+		const char* end = strchr(path, ':');
+		size_t dirLength = end == NULL ? strlen(path) : (size_t)(end - path);
+		char* candidate = malloc(dirLength + nameLength + 3);
+
+		// An empty entry in $PATH is the current directory
+		if (dirLength == 0) strcpy(candidate, ".");
+		else {
+			memcpy(candidate, path, dirLength);
+			candidate[dirLength] = '\0';
+		}
+		strcat(candidate, "/");
+		strcat(candidate, name);
+
+		if (stat(candidate, &sb) == 0 && S_ISREG(sb.st_mode) && access(candidate, X_OK) == 0)
+			return candidate;
+		free(candidate);
+
+		if (end == NULL) return NULL;
+		path = end + 1;
+	}
+}
+
+/**
+* Method used to find the absolute path of a command. Names with a '/' are
+* used as they are, the others are looked up in the command table and $PATH
+* is only scanned the first time a command is run. The table is emptied
+* when $PATH changes. It returns NULL for unknown commands.
+*/
+const char* findCommand(const char* name) {
+	const char* path = getVariable("PATH");
+	struct commandEntry* entry;
+	unsigned int hash;
+
+	if (strchr(name, '/') != NULL) return name;
+
+	if (path == NULL) path = "";
+	if (commandTablePath == NULL || strcmp(commandTablePath, path) != 0) {
+		clearCommandTable();
+		free(commandTablePath);
+		commandTablePath = strdup(path);
+	}
+	if (commandTableSize == 0) {
+		commandTableSize = 64;
+		commandTable = calloc(commandTableSize, sizeof(struct commandEntry*));
+	}
+
+	hash = hashString(name);
+	for (entry = commandTable[hash & (commandTableSize - 1)]; entry != NULL; entry = entry->next) {
+		if (strcmp(entry->name, name) == 0) {
+			entry->hits++;
+			commandHits++;
+			return entry->path;
+		}
+	}
+
+	commandMisses++;
+	char* found = searchPath(name);
+	if (found == NULL) return NULL;
+
+	// The table doubles when it is 3/4 full
+	if ((commandTableCount + 1) * 4 > commandTableSize * 3) {
+		int newSize = commandTableSize * 2;
+		struct commandEntry** newTable = calloc(newSize, sizeof(struct commandEntry*));
+		for (int i = 0; i < commandTableSize; i++) {
+			while (commandTable[i] != NULL) {
+				struct commandEntry* moved = commandTable[i];
+				commandTable[i] = moved->next;
+				moved->next = newTable[hashString(moved->name) & (newSize - 1)];
+				newTable[hashString(moved->name) & (newSize - 1)] = moved;
+			}
+		}
+		free(commandTable);
+		commandTable = newTable;
+		commandTableSize = newSize;
+	}
+
+	entry = malloc(sizeof(struct commandEntry));
+	entry->name = strdup(name);
+	entry->path = found;
+	entry->hits = 1;
+	entry->next = commandTable[hash & (commandTableSize - 1)];
+	commandTable[hash & (commandTableSize - 1)] = entry;
+	commandTableCount++;
+	return entry->path;
+}
+
+/**
+* Builtin hash: without arguments it prints the remembered commands with
+* their hits, "-r" forgets all of them, "-s" prints the hit and miss counters
+* and any other argument is looked up and remembered.
+*/
+int hashCommand(char* args[]) {
+	int status = 0;
+
+	if (args[1] == NULL) {
+		if (commandTableCount == 0) {
+			printf("hash: hash table empty\n");
+			return 0;
+		}
+		printf("hits\tcommand\n");
+		for (int i = 0; i < commandTableSize; i++)
+			for (struct commandEntry* entry = commandTable[i]; entry != NULL; entry = entry->next)
+				printf("%4ld\t%s\n", entry->hits, entry->path);
+		return 0;
+	}
+	if (strcmp(args[1], "-r") == 0) {
+		clearCommandTable();
+		pathIndex.built = 0;
+		return 0;
+	}
+	if (strcmp(args[1], "-s") == 0) {
+		printf("%d commands, %ld hits, %ld misses\n", commandTableCount, commandHits, commandMisses);
+		return 0;
+	}
+	for (int i = 1; args[i] != NULL; i++) {
+		if (isBuiltin(args[i])) continue;
+		if (findCommand(args[i]) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", args[i]);
+			status = 1;
+		}
+	}
+	return status;
+}
+
+/**
+* Builtin rehash: forget every remembered command, like 'hash -r'. The index
+* Tab completes commands from is built again too.
+*/
+int rehashCommand(char* args[]) {
+	clearCommandTable();
+	pathIndex.built = 0;
+	return 0;
+}
+
+/**
+ * VARIABLES
+ */
+
+/**
+* Method used to find a variable of the shell, or NULL if it is not set
+*/
+struct variable* findVariable(const char* name) {
+	struct variable* variable;
+
+	if (variableTableSize == 0) return NULL;
+	for (variable = variableTable[hashString(name) & (variableTableSize - 1)]; variable != NULL;
+		variable = variable->next) {
+		if (strcmp(variable->name, name) == 0) return variable;
+	}
+	return NULL;
+}
+
+/**
+* Method used to get the value of a variable, or NULL if it is not set
+*/
+const char* getVariable(const char* name) {
+	struct variable* variable = findVariable(name);
+
+	return variable != NULL ? variable->value : NULL;
+}
+
+/**
+* Method used to set a variable. Its "NAME=VALUE" entry is built here, so
+* the environment of the children is only an array of these entries. A
+* variable that is exported, or stops being, marks the environment to be
+* built again.
+*/
+void setVariable(const char* name, const char* value, int exported) {
+	struct variable* variable = findVariable(name);
+	size_t nameLength = strlen(name);
+	size_t valueLength = strlen(value);
+
+	if (variable == NULL) {
+		unsigned int bucket;
+
+		// The table doubles when it is 3/4 full
+		if ((variableCount + 1) * 4 > variableTableSize * 3) {
+			int newSize = variableTableSize == 0 ? 64 : variableTableSize * 2;
+			struct variable** newTable = calloc(newSize, sizeof(struct variable*));
+			for (int i = 0; i < variableTableSize; i++) {
+				while (variableTable[i] != NULL) {
+					struct variable* moved = variableTable[i];
+					variableTable[i] = moved->next;
+					moved->next = newTable[hashString(moved->name) & (newSize - 1)];
+					newTable[hashString(moved->name) & (newSize - 1)] = moved;
+				}
+			}
+			free(variableTable);
+			variableTable = newTable;
+			variableTableSize = newSize;
+		}
+		variable = calloc(1, sizeof(struct variable));
+		variable->name = strdup(name);
+		bucket = hashString(name) & (variableTableSize - 1);
+		variable->next = variableTable[bucket];
+		variableTable[bucket] = variable;
+		variableCount++;
+	}
+	else if (strcmp(variable->value, value) == 0) {
+		// Setting the same value only changes whether it is exported
+		if (exported && !variable->exported) {
+			variable->exported = 1;
+			environmentDirty = 1;
+		}
+		return;
+	}
+
+	free(variable->entry);
+	variable->entry = malloc(nameLength + valueLength + 2);
+	memcpy(variable->entry, name, nameLength);
+	variable->entry[nameLength] = '=';
+	memcpy(variable->entry + nameLength + 1, value, valueLength + 1);
+	variable->value = variable->entry + nameLength + 1;
+	variable->exported |= exported;
+	if (variable->exported) environmentDirty = 1;
+}
+
+/**
+* Method used to remove a variable
+*/
+void unsetVariable(const char* name) {
+	struct variable** link;
+
+	if (variableTableSize == 0) return;
+	for (link = &variableTable[hashString(name) & (variableTableSize - 1)]; *link != NULL; link = &(*link)->next) {
+		if (strcmp((*link)->name, name) == 0) {
+			struct variable* variable = *link;
+			*link = variable->next;
+			if (variable->exported) environmentDirty = 1;
+			free(variable->name);
+			free(variable->entry);
+			free(variable);
+			variableCount--;
+			return;
+		}
+	}
+}
+
+/**
+* Method used to get the environment of the children. It is built from the
+* exported variables only when one of them changed since the last time, so
+* a spawn passes it to exec as it is.
+*/
+char** buildEnvironment(void) {
+	int count = 0;
+
+	if (!environmentDirty && environment != NULL) return environment;
+
+	free(environment);
+	environment = malloc((variableCount + 1) * sizeof(char*));
+	for (int i = 0; i < variableTableSize; i++) {
+		for (struct variable* variable = variableTable[i]; variable != NULL; variable = variable->next) {
+			if (variable->exported) environment[count++] = variable->entry;
+		}
+	}
+	environment[count] = NULL;
+	environmentDirty = 0;
+	return environment;
+}
+
+/**
+* Method used to take the environment the shell was started with as its
+* variables, all of them exported
+*/
+void initVariables(char** envp) {
+	for (; *envp != NULL; envp++) {
+		char* equals = strchr(*envp, '=');
+		char* name;
+
+		if (equals == NULL) continue;
+		name = strndup(*envp, equals - *envp);
+		setVariable(name, equals + 1, 1);
+		free(name);
+	}
+}
+
+/**
+* Method used to remember the current directory after it changes. The
+* children see it in $parent, and nothing asks the kernel for it again
+* until the next cd.
+*/
+void updateDirectory(void) {
+	char* directory = getcwd(NULL, 0);
+
+	if (directory == NULL) return;
+	free(currentDirectory);
+	currentDirectory = directory;
+	setVariable("parent", currentDirectory, 1);
+	prompt.dirty = 1;
+}
+
+/**
+* Method used to set the variables of a command made only of assignments
+*/
+void assignVariables(struct command* command) {
+	for (int i = 0; i < command->assignmentCount; i++) {
+		char* equals = strchr(command->assignments[i], '=');
+		*equals = '\0';
+		setVariable(command->assignments[i], equals + 1, 0);
+		*equals = '=';
+	}
+}
+
+/**
+* Method used to get the environment of a command launched with its own
+* assignments, NAME=VALUE cmd. It is the environment of the shell with
+* those entries replaced, built in the line arena.
+*/
+char** commandEnvironment(char** assignments) {
+	char** base = buildEnvironment();
+	char** envp;
+	int baseCount = 0, assignmentCount = 0, count = 0;
+
+	while (base[baseCount] != NULL) baseCount++;
+	while (assignments[assignmentCount] != NULL) assignmentCount++;
+	envp = arenaAlloc(&lineArena, (baseCount + assignmentCount + 1) * sizeof(char*));
+	for (int i = 0; i < baseCount; i++) {
+		size_t nameLength = strchr(base[i], '=') - base[i] + 1;
+		int replaced = 0;
+		for (int j = 0; j < assignmentCount && !replaced; j++)
+			replaced = strncmp(base[i], assignments[j], nameLength) == 0;
+		if (!replaced) envp[count++] = base[i];
+	}
+	for (int j = 0; j < assignmentCount; j++) envp[count++] = assignments[j];
+	envp[count] = NULL;
+	return envp;
+}
+
+static int compareEntries(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+* Builtin export: 'export NAME=VALUE' sets a variable that the children
+* get in their environment, 'export NAME' gives them one that is already
+* set, and 'export' alone lists them
+*/
+int exportCommand(char* args[]) {
+	int status = 0;
+
+	if (args[1] == NULL) {
+		char** envp = buildEnvironment();
+		int count = 0;
+		char** sorted;
+
+		while (envp[count] != NULL) count++;
+		sorted = malloc(count * sizeof(char*));
+		memcpy(sorted, envp, count * sizeof(char*));
+		qsort(sorted, count, sizeof(char*), compareEntries);
+		for (int i = 0; i < count; i++) {
+			char* equals = strchr(sorted[i], '=');
+			printf("export %.*s=\"", (int)(equals - sorted[i]), sorted[i]);
+			for (char* c = equals + 1; *c != '\0'; c++) {
+				if (strchr("\"\\$`", *c) != NULL) putchar('\\');
+				putchar(*c);
+			}
+			printf("\"\n");
+		}
+		free(sorted);
+		return 0;
+	}
+
+	for (int i = 1; args[i] != NULL; i++) {
+		char* equals = strchr(args[i], '=');
+		struct variable* variable;
+
+		if (!isName(args[i], equals != NULL ? (size_t)(equals - args[i]) : strlen(args[i]))) {
+			fprintf(stderr, "export: `%s': not a valid identifier\n", args[i]);
+			status = 1;
+			continue;
+		}
+		if (equals != NULL) {
+			*equals = '\0';
+			setVariable(args[i], equals + 1, 1);
+			*equals = '=';
+		}
+		else if ((variable = findVariable(args[i])) != NULL) setVariable(args[i], variable->value, 1);
+	}
+	return status;
+}
+
+/**
+* Builtin unset: removes variables
+*/
+int unsetCommand(char* args[]) {
+	for (int i = 1; args[i] != NULL; i++) unsetVariable(args[i]);
+	return 0;
+}
+
+/**
+ * SPAWN BACKEND
+ */
+
+/**
+* Method used to reset a spawn description: inherit stdin and stdout, no
+* redirections and a new process group in the background
+*/
+void initSpawnAttr(struct spawnAttr* attr) {
+	attr->inFd = -1;
+	attr->outFd = -1;
+	attr->errFd = -1;
+	attr->redirections = NULL;
+	attr->assignments = NULL;
+	attr->pgid = 0;
+	attr->foreground = 0;
+}
+
+/**
+* Method used to know the descriptor and open flags of a redirection
+*/
+int redirectionFlags(struct redirection* redirection, int* fd) {
+	*fd = redirection->type == REDIRECT_INPUT ? STDIN_FILENO : STDOUT_FILENO;
+	if (redirection->type == REDIRECT_INPUT) return O_RDONLY;
+	if (redirection->type == REDIRECT_OUTPUT) return O_CREAT | O_TRUNC | O_WRONLY;
+	return O_CREAT | O_APPEND | O_WRONLY;
+}
+
+/**
+* Method used to apply the descriptors of attr to the current process. It is
+* what the file actions of posix_spawn do when the fork backend is used.
+*/
+int applyRedirections(struct spawnAttr* attr) {
+	int fileDescriptor;
+	int fd;
+
+	if (attr->inFd != -1) dup2(attr->inFd, STDIN_FILENO);
+	if (attr->outFd != -1) dup2(attr->outFd, STDOUT_FILENO);
+	if (attr->errFd != -1) dup2(attr->errFd, STDERR_FILENO);
+	if (attr->inFd > STDERR_FILENO) close(attr->inFd);
+	if (attr->outFd > STDERR_FILENO) close(attr->outFd);
+	if (attr->errFd > STDERR_FILENO && attr->errFd != attr->outFd) close(attr->errFd);
+
+	// The files are opened after the pipes and in the order they were
+	// written, so the last one of each direction takes precedence
+	for (struct redirection* redirection = attr->redirections; redirection != NULL;
+		redirection = redirection->next) {
+		int flags = redirectionFlags(redirection, &fd);
+		if ((fileDescriptor = open(redirection->file, flags, 0600)) == -1) {
+			perror(redirection->file);
+			return -1;
+		}
+		dup2(fileDescriptor, fd);
+		close(fileDescriptor);
+	}
+	return 0;
+}
+
+/**
+* Method used to block the signals that must not arrive while children are
+* launched and waited: SIGCHLD would let the handler reap them before us and
+* SIGTTOU would stop a child that takes the terminal.
+*/
+void blockChildSignals(sigset_t* oldMask) {
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &mask, oldMask);
+}
+
+/**
+* Method used to fork a child described by attr. In the child it returns 0
+* after joining the process group and applying the redirections, like the
+* exec of posix_spawn would find it. This is the fallback used for builtins
+* inside pipelines and when posix_spawn cannot give the terminal to the child.
+*/
+pid_t forkProcess(struct spawnAttr* attr) {
+	sigset_t empty;
+	pid_t child;
+
+	// What the shell printed comes before what the child prints, and is
+	// not printed again by the child
+	fflush(stdout);
+	child = fork();
+
+	if (child == -1) {
+		printf("Child process could not be created\n");
+		return -1;
+	}
+	// Without job control the children stay in the process group of the shell
+	if (child > 0) {
+		// The parent also sets the process group to avoid racing the child
+		if (GBSH_IS_INTERACTIVE) setpgid(child, attr->pgid == 0 ? child : attr->pgid);
+		return child;
+	}
+
+	if (GBSH_IS_INTERACTIVE) setpgid(0, attr->pgid);
+	if (attr->foreground && GBSH_IS_INTERACTIVE) tcsetpgrp(STDIN_FILENO, getpgrp());
+
+	// The children get the default behaviour for job control signals
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGTTIN, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
+
+	if (applyRedirections(attr) == -1) _exit(EXIT_FAILURE);
+	return 0;
+}
+
+/**
+* Method used to launch a program with posix_spawn. The child never copies
+* the page tables of the shell, and the redirections are file actions.
+*/
+pid_t spawnPosix(const char* path, char* args[], char* envp[], struct spawnAttr* attr) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t spawnAttr;
+	sigset_t defaults, empty;
+	pid_t child;
+	int err;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&spawnAttr);
+
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGINT);
+	sigaddset(&defaults, SIGQUIT);
+	sigaddset(&defaults, SIGTSTP);
+	sigaddset(&defaults, SIGTTIN);
+	sigaddset(&defaults, SIGTTOU);
+	sigaddset(&defaults, SIGCHLD);
+	sigemptyset(&empty);
+	posix_spawnattr_setsigdefault(&spawnAttr, &defaults);
+	posix_spawnattr_setsigmask(&spawnAttr, &empty);
+	posix_spawnattr_setpgroup(&spawnAttr, attr->pgid);
+	// Without job control the children stay in the process group of the shell
+	posix_spawnattr_setflags(&spawnAttr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK |
+		(GBSH_IS_INTERACTIVE ? POSIX_SPAWN_SETPGROUP : 0));
+
+#ifdef HAVE_SPAWN_TCSETPGRP
+	if (attr->foreground && GBSH_IS_INTERACTIVE)
+		posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+	if (attr->inFd != -1) posix_spawn_file_actions_adddup2(&actions, attr->inFd, STDIN_FILENO);
+	if (attr->outFd != -1) posix_spawn_file_actions_adddup2(&actions, attr->outFd, STDOUT_FILENO);
+	if (attr->errFd != -1) posix_spawn_file_actions_adddup2(&actions, attr->errFd, STDERR_FILENO);
+	for (struct redirection* redirection = attr->redirections; redirection != NULL;
+		redirection = redirection->next) {
+		int fd;
+		int flags = redirectionFlags(redirection, &fd);
+		posix_spawn_file_actions_addopen(&actions, fd, redirection->file, flags, 0600);
+	}
+
+	err = posix_spawn(&child, path, &actions, &spawnAttr, args, envp);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&spawnAttr);
+
+	if (err != 0) {
+		// The child may have taken the terminal before failing
+		if (attr->foreground && GBSH_IS_INTERACTIVE) tcsetpgrp(STDIN_FILENO, GBSH_PGID);
+		errno = err;
+		return -1;
+	}
+	return child;
+}
+
+/**
+* Method used to launch an external program described by attr with the
+* selected spawn backend, recording how long the shell spent launching it
+*/
+pid_t spawnProcess(char* args[], struct spawnAttr* attr) {
+	struct timespec start, end;
+	int backend = spawnBackend;
+	const char* path;
+	char** envp;
+	pid_t child;
+
+#ifndef HAVE_SPAWN_TCSETPGRP
+	// Without a tcsetpgrp file action only a forked child can take the
+	// terminal before running the program
+	if (attr->foreground && GBSH_IS_INTERACTIVE) backend = SPAWN_FORK;
+#endif
+
+	// What the shell printed comes before what the program prints
+	fflush(stdout);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	// The environment is only built again when a variable changed
+	envp = attr->assignments != NULL ? commandEnvironment(attr->assignments) : buildEnvironment();
+	// The command is executed directly from its remembered location
+	path = findCommand(args[0]);
+	if (path == NULL) {
+		fprintf(stderr, "%s: command not found\n", args[0]);
+		errno = ENOENT;
+		return -1;
+	}
+	if (backend == SPAWN_POSIX) {
+		child = spawnPosix(path, args, envp, attr);
+		// A remembered command that was removed is looked up again
+		if (child == -1 && errno == ENOENT && path != args[0]) {
+			forgetCommand(args[0]);
+			if ((path = findCommand(args[0])) != NULL) child = spawnPosix(path, args, envp, attr);
+		}
+		if (child == -1) {
+			int error = errno;
+			fprintf(stderr, "%s: %s\n", args[0], strerror(error));
+			errno = error;
+		}
+	}
+	else {
+		child = forkProcess(attr);
+		if (child == 0) {
+			execve(path, args, envp);
+			fprintf(stderr, "%s: %s\n", args[0], strerror(errno));
+			_exit(spawnFailureStatus(errno));
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (child > 0) {
+		double elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+		struct spawnStat* stat = &spawnStats[backend];
+
+		if (stat->count == 0 || elapsed < stat->min) stat->min = elapsed;
+		if (elapsed > stat->max) stat->max = elapsed;
+		stat->total += elapsed;
+		stat->count++;
+		if (spawnVerbose)
+			fprintf(stderr, "spawn %s: %.1f us (%s)\n", args[0], elapsed, spawnBackendNames[backend]);
+	}
+	return child;
+}
+
+/**
+* Method used to turn a wait status into the status of a command: its exit
+* code, or 128 plus the number of the signal that ended or stopped it
+*/
+int exitStatus(int status) {
+	if (WIFEXITED(status)) return WEXITSTATUS(status);
+	if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+	return 1;
+}
+
+/**
+* Method used to get the status of a foreground command from its wait
+* status. Like other shells we tell the user about the signals that killed
+* it, except SIGPIPE which is the usual end of a pipeline stage.
+*/
+int decodeStatus(int status) {
+	if (WIFSIGNALED(status)) {
+		if (WTERMSIG(status) == SIGINT) fprintf(stderr, "\n");
+		else if (WTERMSIG(status) != SIGPIPE)
+			fprintf(stderr, "%s%s\n", strsignal(WTERMSIG(status)), WCOREDUMP(status) ? " (core dumped)" : "");
+	}
+	return exitStatus(status);
+}
+
+/**
+* Method used to know the status of a command that could not be launched:
+* 127 when it does not exist and 126 when it cannot be executed
+*/
+int spawnFailureStatus(int error) {
+	return error == ENOENT ? 127 : 126;
+}
+
+/**
+* Method used to wait for the foreground processes of one process group,
+* which owns the terminal meanwhile. The status of each process is stored
+* in statuses; the ones that were not launched (pid <= 0) keep theirs.
+* When a process stops, the pipeline becomes a stopped job. It returns the
+* status of the last process.
+*/
+int waitForeground(pid_t pids[], int count, pid_t pgid, int statuses[], struct pipeline* pipeline,
+	struct stageTime times[]) {
+	struct stageTime ioTime = { 0 };
+	struct rusage usage;
+	int status = 0;
+	int stopped = -1;
+	int waiting = 0;
+	int next = 0;
+	pid_t child;
+	int i;
+
+	if (GBSH_IS_INTERACTIVE && count > 0) tcsetpgrp(STDIN_FILENO, pgid);
+
+	for (i = 0; i < count; i++) waiting += pids[i] > 0;
+	while (waiting > 0 && stopped == -1) {
+		if (times == NULL) {
+			// The processes are waited in order
+			while (pids[next] <= 0) next++;
+			i = next++;
+			child = waitpid(pids[i], &status, WUNTRACED);
+		}
+		else {
+			// A timed pipeline takes its processes as they end, so the
+			// wall time of each one is right. With pipestats what the
+			// process read and wrote is taken before it is reaped.
+			pid_t ended = -1;
+			siginfo_t info;
+			if (optionPipeStats) {
+				info.si_pid = 0;
+				if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOWAIT) == -1) {
+					if (errno == EINTR) continue;
+					break;
+				}
+				ended = info.si_pid;
+				ioTime.readBytes = ioTime.writtenBytes = 0;
+				readProcessIo(ended, &ioTime);
+			}
+			if ((child = wait4(ended, &status, WUNTRACED, &usage)) == -1) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			for (i = 0; i < count && pids[i] != child; i++);
+			if (i == count) {
+				// Another child of the shell, from a job
+				updateProcess(child, status);
+				continue;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &times[i].end);
+			times[i].usage = usage;
+			times[i].readBytes = ioTime.readBytes;
+			times[i].writtenBytes = ioTime.writtenBytes;
+		}
+		waiting--;
+		// A stopped process also ends the wait, so the shell gets the
+		// terminal back
+		if (child == -1) statuses[i] = 127;
+		else statuses[i] = decodeStatus(status);
+		if (child != -1 && WIFSTOPPED(status)) stopped = i;
+	}
+	if (GBSH_IS_INTERACTIVE) {
+		tcsetpgrp(STDIN_FILENO, GBSH_PGID);
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &GBSH_TMODES);
+	}
+
+	if (stopped != -1) {
+		pid_t jobPids[count];
+		struct job* job;
+
+		// The processes that ended are part of the job as done
+		for (i = 0; i < count; i++) {
+			jobPids[i] = i < stopped ? -1 : pids[i];
+			if (i > stopped) statuses[i] = statuses[stopped];
+		}
+		if ((job = addJob(pgid, jobPids, statuses, count, describePipeline(pipeline))) != NULL) {
+			updateProcess(pids[stopped], status);
+			// The rest of the group stops with it most of the time
+			for (i = stopped + 1; i < count; i++)
+				if (pids[i] > 0 && waitpid(pids[i], &status, WNOHANG | WUNTRACED) > 0) updateProcess(pids[i], status);
+			job->notify = 0;
+			printf("\n");
+			printJob(job);
+		}
+	}
+	return count > 0 ? statuses[count - 1] : 0;
+}
+
+/**
+* Method used to know the status of a pipeline from the status of its
+* stages: the one of the last stage, or with the pipefail option the one of
+* the last stage that failed
+*/
+int pipelineStatus(int statuses[], int count) {
+	if (optionPipefail) {
+		for (int i = count - 1; i >= 0; i--)
+			if (statuses[i] != 0) return statuses[i];
+		return 0;
+	}
+	return statuses[count - 1];
+}
+
+/**
+* Builtin used to look at the spawn latency. Without arguments it prints the
+* statistics of each backend; "verbose" and "quiet" turn on and off the
+* report of every command, "posix_spawn" and "fork" select the backend and
+* "reset" clears the statistics.
+*/
+int spawnStatCommand(char* args[]) {
+	if (args[1] == NULL) {
+		for (int i = 0; i < 2; i++) {
+			struct spawnStat* stat = &spawnStats[i];
+			printf("%s%s: %ld spawns", spawnBackendNames[i], i == spawnBackend ? " (active)" : "",
+				stat->count);
+			if (stat->count > 0)
+				printf(", avg %.1f us, min %.1f us, max %.1f us", stat->total / stat->count,
+					stat->min, stat->max);
+			printf("\n");
+		}
+		return 0;
+	}
+	if (strcmp(args[1], "verbose") == 0) spawnVerbose = 1;
+	else if (strcmp(args[1], "quiet") == 0) spawnVerbose = 0;
+	else if (strcmp(args[1], "posix_spawn") == 0) spawnBackend = SPAWN_POSIX;
+	else if (strcmp(args[1], "fork") == 0) spawnBackend = SPAWN_FORK;
+	else if (strcmp(args[1], "reset") == 0) memset(spawnStats, 0, sizeof(spawnStats));
+	else {
+		fprintf(stderr, "spawnstat: usage: spawnstat [verbose|quiet|posix_spawn|fork|reset]\n");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+* Method for launching a program. It can be run in the background
+* or in the foreground, and its redirections are file actions of the
+* spawned child.
+*/
+int launchProg(struct command* command, int background) {
+	struct pipeline single = { command, 1, background, 0 };
+	struct spawnAttr attr;
+	struct job* job;
+	sigset_t oldMask;
+	int status = 0;
+	pid_t child;
+
+	initSpawnAttr(&attr);
+	attr.redirections = command->redirections;
+	attr.assignments = command->assignments;
+	attr.foreground = !background;
+
+	blockChildSignals(&oldMask);
+	child = spawnProcess(command->argv, &attr);
+
+	// If the process is not requested to be in background, we wait for
+	// the child to finish.
+	if (child > 0 && background == 0) {
+		status = waitForeground(&child, 1, child, &status, &single, NULL);
+	}
+	else if (child > 0) {
+		// In order to create a background process, the current process
+		// should just skip the call to wait. The job table keeps it until
+		// it is reaped.
+		job = addJob(child, &child, &status, 1, describePipeline(&single));
+		printf("[%d] Process created with PID: %d\n", job != NULL ? job->id : 0, child);
+		lastBackground = child;
+	}
+	else status = spawnFailureStatus(errno);
+	sigprocmask(SIG_SETMASK, &oldMask, NULL);
+	return status;
+}
+
+/**
+ * JOBS
+ */
+
+/**
+* Method used to prepare the job table. SIGCHLD only writes a byte to a
+* pipe, and the shell reaps its children when it reads the pipe.
+*/
+void initJobs(void) {
+	if (pipe2(selfPipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
+	}
+	act_child.sa_handler = signalHandler_child;
+	act_child.sa_flags = SA_RESTART;
+	sigemptyset(&act_child.sa_mask);
+	sigaction(SIGCHLD, &act_child, 0);
+}
+
+/**
+* Method used to spread the process groups and the pids over the buckets of
+* the job tables
+*/
+unsigned int jobHash(pid_t pid) {
+	return ((unsigned int)pid * 2654435761u) >> (32 - JOB_TABLE_BITS);
+}
+
+/**
+* Method used to give a job the text of its pipeline, as it is listed by jobs
+*/
+char* describePipeline(struct pipeline* pipeline) {
+	char* text = NULL;
+
+	for (int i = 0; i < pipeline->count; i++) {
+		struct command* stage = &pipeline->stages[i];
+		char* stageText;
+		char* joined;
+		size_t length = 1;
+
+		if (stage->compound != NULL) stageText = describeNode(stage->compound);
+		else {
+			for (int j = 0; j < stage->assignmentCount; j++) length += strlen(stage->assignments[j]) + 1;
+			for (int j = 0; j < stage->argc; j++) length += strlen(stage->argv[j]) + 1;
+			if ((stageText = malloc(length)) != NULL) {
+				stageText[0] = '\0';
+				for (int j = 0; j < stage->assignmentCount + stage->argc; j++) {
+					if (j > 0) strcat(stageText, " ");
+					strcat(stageText, j < stage->assignmentCount ? stage->assignments[j] :
+						stage->argv[j - stage->assignmentCount]);
+				}
+				// A tree that was not expanded still has the markers
+				if (strpbrk(stageText, WORD_MARKERS) != NULL) stageText = describeMarkers(stageText);
+			}
+		}
+		if (stageText == NULL) {
+			free(text);
+			return NULL;
+		}
+		if (text == NULL) text = stageText;
+		else {
+			if (asprintf(&joined, "%s | %s", text, stageText) == -1) joined = NULL;
+			free(text);
+			free(stageText);
+			if ((text = joined) == NULL) return NULL;
+		}
+	}
+	return text;
+}
+
+/**
+* Method used to write the markers of a text that was not expanded as they
+* were typed. It releases the text and returns a new one.
+*/
+char* describeMarkers(char* text) {
+	char* described = malloc(2 * strlen(text) + 1);
+	char* dst = described;
+
+	if (described == NULL) return text;
+	for (char* src = text; *src != '\0'; src++) {
+		if (*src == EXPAND_MARKER || *src == EXPAND_QUOTED_MARKER) *dst++ = '$';
+		else if (*src == SUBSTITUTION_MARKER || *src == SUBSTITUTION_QUOTED_MARKER) {
+			*dst++ = '$';
+			*dst++ = '(';
+		}
+		else if (*src == SUBSTITUTION_END) *dst++ = ')';
+		else if (*src == GLOB_STAR) *dst++ = '*';
+		else if (*src == GLOB_ANY) *dst++ = '?';
+		else if (*src == GLOB_SET) *dst++ = '[';
+		else *dst++ = *src;
+	}
+	*dst = '\0';
+	free(text);
+	return described;
+}
+
+/**
+* Method used to give a job the text of a command tree, for the subshells
+* that run in the background
+*/
+char* describeNode(struct node* node) {
+	const char* separator = node->type == NODE_AND ? " && " : node->type == NODE_OR ? " || " : "; ";
+	char* left;
+	char* right;
+	char* text;
+
+	if (node->type == NODE_PIPELINE) return describePipeline(node->pipeline);
+	if (node->type == NODE_BACKGROUND) return describeNode(node->left);
+
+	left = describeNode(node->left);
+	right = node->right != NULL ? describeNode(node->right) : NULL;
+	if (node->type == NODE_IF) {
+		char* elseText = node->elseBranch != NULL ? describeNode(node->elseBranch) : NULL;
+		if (left != NULL && right != NULL &&
+			asprintf(&text, "if %s then %s%s%s end", left, right, elseText != NULL ? " else " : "", elseText != NULL ? elseText : "") == -1)
+			text = NULL;
+		free(elseText);
+	}
+	else if (left == NULL || right == NULL || asprintf(&text, "%s%s%s", left, separator, right) == -1) text = NULL;
+	free(left);
+	free(right);
+	return text;
+}
+
+/**
+* Method used to find a job from what the user wrote: '%N' is the job
+* number N, '%%', '%+' or nothing the last job, and a number is the process
+* group or the pid of one of its processes
+*/
+struct job* findJob(const char* spec) {
+	struct job* job;
+	struct jobProcess* process;
+	pid_t id;
+
+	if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+		for (job = jobList; job != NULL && job->nextJob != NULL; job = job->nextJob);
+		return job;
+	}
+	if (spec[0] == '%') {
+		id = atoi(spec + 1);
+		for (job = jobList; job != NULL; job = job->nextJob)
+			if (job->id == id) return job;
+		return NULL;
+	}
+	id = atoi(spec);
+	for (job = jobTable[jobHash(id)]; job != NULL; job = job->next)
+		if (job->pgid == id) return job;
+	for (process = processTable[jobHash(id)]; process != NULL; process = process->next)
+		if (process->pid == id) return process->job;
+	return NULL;
+}
+
+/**
+* Method used to add a job to the table, with the lowest free number. The
+* processes with pid <= 0 were never launched and are done with their
+* status from statuses.
+*/
+struct job* addJob(pid_t pgid, pid_t pids[], int statuses[], int count, char* command) {
+	struct job* job = calloc(1, sizeof(struct job));
+	struct job** link = &jobList;
+	int id = 1;
+
+	if (job == NULL || (job->processes = calloc(count, sizeof(struct jobProcess))) == NULL) {
+		free(job);
+		free(command);
+		return NULL;
+	}
+	job->pgid = pgid;
+	job->count = count;
+	job->command = command;
+	for (int i = 0; i < count; i++) {
+		struct jobProcess* process = &job->processes[i];
+
+		process->pid = pids[i];
+		process->job = job;
+		if (pids[i] <= 0) {
+			process->state = JOB_DONE;
+			process->status = statuses[i];
+			job->done++;
+			continue;
+		}
+		process->state = JOB_RUNNING;
+		process->next = processTable[jobHash(pids[i])];
+		processTable[jobHash(pids[i])] = process;
+		job->running++;
+	}
+	job->state = job->running > 0 ? JOB_RUNNING : JOB_DONE;
+
+	// The list is kept in the order of the numbers
+	while (*link != NULL && (*link)->id == id) {
+		link = &(*link)->nextJob;
+		id++;
+	}
+	job->id = id;
+	job->nextJob = *link;
+	*link = job;
+	job->next = jobTable[jobHash(pgid)];
+	jobTable[jobHash(pgid)] = job;
+	return job;
+}
+
+/**
+* Method used to remove a job from the table and release it
+*/
+void removeJob(struct job* job) {
+	struct job** link;
+
+	for (int i = 0; i < job->count; i++) {
+		struct jobProcess** process;
+		if (job->processes[i].pid <= 0) continue;
+		for (process = &processTable[jobHash(job->processes[i].pid)]; *process != NULL; process = &(*process)->next) {
+			if (*process == &job->processes[i]) {
+				*process = (*process)->next;
+				break;
+			}
+		}
+	}
+	for (link = &jobTable[jobHash(job->pgid)]; *link != NULL; link = &(*link)->next) {
+		if (*link == job) {
+			*link = job->next;
+			break;
+		}
+	}
+	for (link = &jobList; *link != NULL; link = &(*link)->nextJob) {
+		if (*link == job) {
+			*link = job->nextJob;
+			break;
+		}
+	}
+	free(job->processes);
+	free(job->command);
+	free(job);
+}
+
+/**
+* Method used to forget the jobs of the parent in a forked copy of the shell,
+* whose children they are not
+*/
+void forgetJobs(void) {
+	memset(jobTable, 0, sizeof(jobTable));
+	memset(processTable, 0, sizeof(processTable));
+	jobList = NULL;
+}
+
+/**
+* Method used to record a change of state of a process of a job. The job is
+* done when all its processes are, and stopped when none of them runs.
+*/
+void updateProcess(pid_t pid, int status) {
+	struct jobProcess* process;
+	struct job* job;
+	int state;
+
+	for (process = processTable[jobHash(pid)]; process != NULL && process->pid != pid; process = process->next);
+	if (process == NULL || process->state == JOB_DONE) return;
+	job = process->job;
+
+	if (WIFSTOPPED(status)) state = JOB_STOPPED;
+	else if (WIFCONTINUED(status)) state = JOB_RUNNING;
+	else state = JOB_DONE;
+	if (state == process->state) return;
+
+	job->running -= process->state == JOB_RUNNING;
+	job->running += state == JOB_RUNNING;
+	job->done += state == JOB_DONE;
+	process->state = state;
+	if (state != JOB_RUNNING) process->status = exitStatus(status);
+
+	state = job->done == job->count ? JOB_DONE : job->running > 0 ? JOB_RUNNING : JOB_STOPPED;
+	if (state != job->state) {
+		job->state = state;
+		job->notify = state != JOB_RUNNING;
+	}
+	if (state == JOB_DONE && WIFSIGNALED(status)) job->signal = WTERMSIG(status);
+}
+
+/**
+* Method used to reap the children whose state changed. The pipe tells if
+* SIGCHLD came since the last time, so nothing is asked to the kernel
+* otherwise.
+*/
+void reapJobs(void) {
+	char bytes[64];
+	int status;
+	int signaled = 0;
+	pid_t child;
+
+	while (read(selfPipe[0], bytes, sizeof(bytes)) > 0) signaled = 1;
+	if (!signaled || jobList == NULL) return;
+	while ((child = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) updateProcess(child, status);
+}
+
+/**
+* Method used to know the status of a job from the status of its processes
+*/
+int jobStatus(struct job* job) {
+	int statuses[job->count];
+
+	for (int i = 0; i < job->count; i++) statuses[i] = job->processes[i].status;
+	return pipelineStatus(statuses, job->count);
+}
+
+/**
+* Method used to print the state of a job
+*/
+void printJob(struct job* job) {
+	int status = jobStatus(job);
+
+	if (job->state == JOB_RUNNING) printf("[%d] Running\t\t%s\n", job->id, job->command);
+	else if (job->state == JOB_STOPPED) printf("[%d] Stopped\t\t%s\n", job->id, job->command);
+	else if (job->signal != 0) printf("[%d] %s\t\t%s\n", job->id, strsignal(job->signal), job->command);
+	else if (status != 0) printf("[%d] Exit %d\t\t%s\n", job->id, status, job->command);
+	else printf("[%d] Done\t\t%s\n", job->id, job->command);
+}
+
+/**
+* Method used to tell the user about the jobs that finished or stopped
+* since the last prompt, all at once. The finished jobs are then removed.
+*/
+void notifyJobs(void) {
+	struct job* job;
+	struct job* next;
+
+	reapJobs();
+	for (job = jobList; job != NULL; job = next) {
+		next = job->nextJob;
+		if (!job->notify) continue;
+		job->notify = 0;
+		printJob(job);
+		if (job->state == JOB_DONE) removeJob(job);
+	}
+	fflush(stdout);
+}
+
+/**
+* Method used to wait for a job in the foreground, giving it the terminal.
+* A job that stops goes back to the table. It returns the status of the job.
+*/
+int waitJob(struct job* job) {
+	int status = 0;
+
+	if (GBSH_IS_INTERACTIVE) tcsetpgrp(STDIN_FILENO, job->pgid);
+	while (job->state == JOB_RUNNING) {
+		pid_t child = waitpid(-job->pgid, &status, WUNTRACED);
+		// Without job control the processes are not in their own group
+		if (child == -1 && errno == ECHILD && !GBSH_IS_INTERACTIVE) {
+			for (int i = 0; i < job->count && child == -1; i++)
+				if (job->processes[i].state == JOB_RUNNING) child = waitpid(job->processes[i].pid, &status, WUNTRACED);
+		}
+		if (child == -1) {
+			// An interrupted wait leaves the job as it is
+			if (errno == EINTR) break;
+			job->state = JOB_DONE;
+			break;
+		}
+		updateProcess(child, status);
+	}
+	if (GBSH_IS_INTERACTIVE) {
+		tcsetpgrp(STDIN_FILENO, GBSH_PGID);
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &GBSH_TMODES);
+	}
+
+	job->notify = 0;
+	if (job->state == JOB_STOPPED) {
+		printf("\n");
+		printJob(job);
+		return 128 + SIGTSTP;
+	}
+	if (job->state == JOB_RUNNING) return 130;
+	status = jobStatus(job);
+	if (job->signal == SIGINT) fprintf(stderr, "\n");
+	else if (job->signal != 0 && job->signal != SIGPIPE) fprintf(stderr, "%s\n", strsignal(job->signal));
+	removeJob(job);
+	return status;
+}
+
+/**
+* Method used to send a signal to every process of a job
+*/
+void signalJob(struct job* job, int signal) {
+	// With job control the whole group gets it at once
+	if (GBSH_IS_INTERACTIVE && kill(-job->pgid, signal) == 0) return;
+	for (int i = 0; i < job->count; i++)
+		if (job->processes[i].state != JOB_DONE) kill(job->processes[i].pid, signal);
+}
+
+/**
+* Method used to let the processes of a stopped job go on
+*/
+void continueJob(struct job* job) {
+	for (int i = 0; i < job->count; i++) {
+		if (job->processes[i].state != JOB_STOPPED) continue;
+		job->processes[i].state = JOB_RUNNING;
+		job->running++;
+	}
+	job->state = JOB_RUNNING;
+	signalJob(job, SIGCONT);
+}
+
+/**
+* Builtin jobs: lists the jobs and their state
+*/
+int jobsCommand(char* args[]) {
+	struct job* job;
+	struct job* next;
+
+	reapJobs();
+	for (job = jobList; job != NULL; job = next) {
+		next = job->nextJob;
+		job->notify = 0;
+		printJob(job);
+		if (job->state == JOB_DONE) removeJob(job);
+	}
+	return 0;
+}
+
+/**
+* Builtin fg: brings a job to the foreground and waits for it
+*/
+int fgCommand(char* args[]) {
+	struct job* job;
+	sigset_t oldMask;
+	int status;
+
+	reapJobs();
+	if ((job = findJob(args[1])) == NULL) {
+		fprintf(stderr, "fg: %s: no such job\n", args[1] != NULL ? args[1] : "current");
+		return 1;
+	}
+	printf("%s\n", job->command);
+	fflush(stdout);
+
+	blockChildSignals(&oldMask);
+	if (GBSH_IS_INTERACTIVE) tcsetpgrp(STDIN_FILENO, job->pgid);
+	if (job->state == JOB_STOPPED) continueJob(job);
+	status = waitJob(job);
+	sigprocmask(SIG_SETMASK, &oldMask, NULL);
+	return status;
+}
+
+/**
+* Builtin bg: lets a stopped job go on in the background
+*/
+int bgCommand(char* args[]) {
+	struct job* job;
+
+	reapJobs();
+	if ((job = findJob(args[1])) == NULL) {
+		fprintf(stderr, "bg: %s: no such job\n", args[1] != NULL ? args[1] : "current");
+		return 1;
+	}
+	if (job->state == JOB_STOPPED) continueJob(job);
+	printf("[%d] %s &\n", job->id, job->command);
+	return 0;
+}
+
+/**
+* Builtin wait: waits for the given jobs, or for all of them, and returns
+* the status of the last one
+*/
+int waitCommand(char* args[]) {
+	struct job* job;
+	int status = 0;
+	int child;
+
+	if (args[1] == NULL) {
+		// Every change is recorded until all the jobs are done or stopped
+		while ((child = waitpid(-1, &status, WUNTRACED)) > 0) updateProcess(child, status);
+		if (child == -1 && errno == EINTR) return 130;
+		for (job = jobList; job != NULL; job = jobList) {
+			while (job != NULL && job->state != JOB_DONE) job = job->nextJob;
+			if (job == NULL) break;
+			removeJob(job);
+		}
+		return 0;
+	}
+
+	for (int i = 1; args[i] != NULL; i++) {
+		if ((job = findJob(args[i])) == NULL) {
+			fprintf(stderr, "wait: %s: no such job\n", args[i]);
+			status = 127;
+			continue;
+		}
+		while (job->state == JOB_RUNNING) {
+			if ((child = waitpid(-1, &status, WUNTRACED)) == -1) break;
+			updateProcess(child, status);
+		}
+		if (job->state == JOB_RUNNING) {
+			if (errno == EINTR) return 130;
+			// Nothing is left to wait for, the job was reaped elsewhere
+			job->state = JOB_DONE;
+		}
+		status = job->state == JOB_DONE ? jobStatus(job) : 128 + SIGTSTP;
+		if (job->state == JOB_DONE) removeJob(job);
+	}
+	return status;
+}
+
+/**
+ * PARALLEL
+ */
+
+/**
+* Method used to copy what a file holds, from its beginning, to another
+* descriptor
+*/
+int copyFile(int in, int out) {
+	if (lseek(in, 0, SEEK_SET) == -1) return -1;
+	return moveData(in, out);
+}
+
+/**
+* Method used to build the arguments of one job of parallel: every '{}' of
+* the template is replaced by the argument, or the argument is added at the
+* end when the template has none. The words are allocated, so they live as
+* long as the job.
+*/
+char** parallelArguments(char* template[], int count, const char* argument) {
+	size_t argumentLength = strlen(argument);
+	char** argv = calloc(count + 2, sizeof(char*));
+	int replaced = 0;
+	int i;
+
+	if (argv == NULL) return NULL;
+	for (i = 0; i < count; i++) {
+		size_t length = strlen(template[i]) + 1;
+		const char* word;
+		char* out;
+
+		for (word = strstr(template[i], "{}"); word != NULL; word = strstr(word + 2, "{}")) length += argumentLength;
+		if ((argv[i] = out = malloc(length)) == NULL) break;
+		for (word = template[i]; *word != '\0';) {
+			if (word[0] == '{' && word[1] == '}') {
+				memcpy(out, argument, argumentLength);
+				out += argumentLength;
+				word += 2;
+				replaced = 1;
+			}
+			else *out++ = *word++;
+		}
+		*out = '\0';
+	}
+	if (i == count && !replaced) argv[i] = strdup(argument);
+	if (i < count || (!replaced && argv[i] == NULL)) {
+		freeArguments(argv);
+		return NULL;
+	}
+	return argv;
+}
+
+/**
+* Method used to release the arguments of a job of parallel
+*/
+void freeArguments(char** argv) {
+	for (int i = 0; argv != NULL && argv[i] != NULL; i++) free(argv[i]);
+	free(argv);
+}
+
+/**
+* Method used to launch one job of parallel. Its output and errors go to a
+* memory file, which is printed as a whole when the job ends.
+*/
+int launchParallelJob(struct parallelJob* job, char** argv, int devNull) {
+	struct command command = { argv, 0, NULL, NULL };
+	const struct builtin* builtin = findBuiltin(argv[0]);
+	struct spawnAttr attr;
+
+	while (argv[command.argc] != NULL) command.argc++;
+	if ((job->output = memfd_create("parallel", MFD_CLOEXEC)) == -1) return -1;
+
+	initSpawnAttr(&attr);
+	attr.inFd = devNull;
+	attr.outFd = job->output;
+	attr.errFd = job->output;
+	// The jobs share the group of the shell, so Ctrl+C reaches them all
+	attr.pgid = GBSH_PGID;
+
+	if (builtin == NULL) job->pid = spawnProcess(argv, &attr);
+	else if ((job->pid = forkProcess(&attr)) == 0) executeStage(&command);
+
+	if (job->pid <= 0) {
+		close(job->output);
+		job->pid = 0;
+		return -1;
+	}
+	job->argv = argv;
+	job->pidfd = syscall(SYS_pidfd_open, job->pid, 0);
+	return 0;
+}
+
+/**
+* Method used to reap a job of parallel that ended and to print its output.
+* It returns the status of the job.
+*/
+int finishParallelJob(struct parallelJob* job) {
+	int status = 0;
+
+	while (waitpid(job->pid, &status, 0) == -1 && errno == EINTR);
+	fflush(stdout);
+	copyFile(job->output, STDOUT_FILENO);
+	close(job->output);
+	if (job->pidfd != -1) close(job->pidfd);
+	freeArguments(job->argv);
+	memset(job, 0, sizeof(struct parallelJob));
+	return exitStatus(status);
+}
+
+/**
+* Builtin parallel: runs a command once for every argument, with at most N
+* jobs at the same time.
+* 'parallel [-j N] [-a FILE] COMMAND [ARGS...] [::: ARGUMENTS...]'. The
+* arguments are the lines of FILE, or of the standard input, or the words
+* after ':::'. The output of each job is printed together when it ends,
+* and the status is the number of jobs that failed.
+*/
+int parallelCommand(char* args[]) {
+	long limit = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* file = NULL;
+	char** template;
+	char** words = NULL;
+	char* line = NULL;
+	size_t lineCapacity = 0;
+	FILE* input = NULL;
+	int count = 0;
+	int running = 0;
+	int launched = 0;
+	int failed = 0;
+	int devNull;
+	int i = 1;
+
+	for (; args[i] != NULL && args[i][0] == '-' && args[i + 1] != NULL; i += 2) {
+		if (strcmp(args[i], "-j") == 0) limit = atol(args[i + 1]);
+		else if (strcmp(args[i], "-a") == 0) file = args[i + 1];
+		else break;
+	}
+	template = &args[i];
+	while (template[count] != NULL && strcmp(template[count], ":::") != 0) count++;
+	if (count == 0 || limit < 1) {
+		fprintf(stderr, "parallel: usage: parallel [-j N] [-a FILE] COMMAND [ARGS...] [::: ARGUMENTS...]\n");
+		return 2;
+	}
+	if (limit > PARALLEL_MAX_JOBS) limit = PARALLEL_MAX_JOBS;
+
+	if (template[count] != NULL) words = &template[count + 1];
+	else {
+		// The standard input is read from a copy, which is closed at the end
+		int fd = file != NULL ? open(file, O_RDONLY | O_CLOEXEC) : fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+		if (fd == -1 || (input = fdopen(fd, "r")) == NULL) {
+			perror(file != NULL ? file : "parallel");
+			if (fd != -1) close(fd);
+			return 2;
+		}
+	}
+	if ((devNull = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1) {
+		perror("/dev/null");
+		if (input != NULL) fclose(input);
+		return 2;
+	}
+
+	struct parallelJob jobs[limit];
+	struct pollfd ready[limit];
+	memset(jobs, 0, sizeof(jobs));
+	lineInterrupted = 0;
+
+	while (TRUE) {
+		// The free slots are filled first, until Ctrl+C or the end of the
+		// arguments
+		for (i = 0; i < limit && !lineInterrupted; i++) {
+			const char* argument;
+			char** argv;
+
+			if (jobs[i].pid != 0) continue;
+			if (words != NULL) argument = *words != NULL ? *words++ : NULL;
+			else {
+				ssize_t length;
+				do length = getline(&line, &lineCapacity, input);
+				while (length == 1 && line[0] == '\n');
+				if (length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+				argument = length > 0 ? line : NULL;
+			}
+			if (argument == NULL) break;
+
+			launched++;
+			if ((argv = parallelArguments(template, count, argument)) == NULL ||
+				launchParallelJob(&jobs[i], argv, devNull) == -1) {
+				if (argv != NULL) freeArguments(argv);
+				failed++;
+				continue;
+			}
+			running++;
+		}
+		if (running == 0) break;
+
+		// Then we sleep until a job ends. The jobs are watched through
+		// their pidfd, so the other children of the shell are left alone.
+		// A job without one is waited for directly.
+		int blocking = -1;
+		for (i = 0; i < limit; i++) {
+			ready[i].fd = jobs[i].pid != 0 ? jobs[i].pidfd : -1;
+			ready[i].events = POLLIN;
+			ready[i].revents = 0;
+			if (jobs[i].pid != 0 && jobs[i].pidfd == -1) blocking = i;
+		}
+		if (blocking != -1) ready[blocking].revents = POLLIN;
+		else if (poll(ready, limit, -1) <= 0) continue;
+
+		for (i = 0; i < limit; i++) {
+			if (jobs[i].pid == 0 || ready[i].revents == 0) continue;
+			if (finishParallelJob(&jobs[i]) != 0) failed++;
+			running--;
+		}
+	}
+
+	free(line);
+	if (input != NULL) fclose(input);
+	close(devNull);
+	if (failed > 0) fprintf(stderr, "parallel: %d of %d jobs failed\n", failed, launched);
+	return failed > 101 ? 101 : failed;
+}
+
+/**
+ * DATA MOVEMENT
+ */
+
+/**
+* Method used to move everything left in a descriptor to another one. The
+* data stays in the kernel when it can: copy_file_range between two files,
+* splice when one of them is a pipe and sendfile from a file. Blocks are
+* read and written through a large buffer only when the kernel refuses.
+* Ctrl+C stops it.
+*/
+int moveData(int in, int out) {
+	static char* buffer;
+	struct stat inStat, outStat;
+	int append = fcntl(out, F_GETFL) & O_APPEND;
+	ssize_t n = -1;
+
+	if (fstat(in, &inStat) == -1 || fstat(out, &outStat) == -1) return -1;
+	errno = EINVAL;
+
+	// A file opened to append can only be written to
+	if (!append && S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode)) {
+		while ((n = copy_file_range(in, NULL, out, NULL, MOVE_CHUNK_SIZE, 0)) > 0 ||
+			(n == -1 && errno == EINTR && !lineInterrupted))
+			if (n > 0) movedBytes += n;
+	}
+	else if (!append && (S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode))) {
+		while ((n = splice(in, NULL, out, NULL, MOVE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0 ||
+			(n == -1 && errno == EINTR && !lineInterrupted))
+			if (n > 0) movedBytes += n;
+	}
+	else if (S_ISREG(inStat.st_mode)) {
+		while ((n = sendfile(out, in, NULL, MOVE_CHUNK_SIZE)) > 0 || (n == -1 && errno == EINTR && !lineInterrupted))
+			if (n > 0) movedBytes += n;
+	}
+	if (n == 0) return 0;
+	if (errno != EINVAL && errno != ENOSYS && errno != EXDEV && errno != EOPNOTSUPP && errno != EBADF) return -1;
+
+	// What was moved before the kernel refused is not read again
+	if (buffer == NULL && (buffer = malloc(MOVE_BUFFER_SIZE)) == NULL) return -1;
+	while ((n = read(in, buffer, MOVE_BUFFER_SIZE)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR && !lineInterrupted) continue;
+			return -1;
+		}
+		if (writeAll(out, buffer, n) == -1) return -1;
+	}
+	return 0;
+}
+
+/**
+* Method used to write length bytes, in as many writes as it takes
+*/
+int writeAll(int fd, const char* data, size_t length) {
+	ssize_t n;
+
+	while (length > 0) {
+		if ((n = write(fd, data, length)) == -1) {
+			if (errno == EINTR && !lineInterrupted) continue;
+			return -1;
+		}
+		data += n;
+		length -= n;
+	}
+	return 0;
+}
+
+/**
+* Method used to copy a pipe to several descriptors without bringing the
+* data to the shell. Each round the data waiting in the pipe is duplicated
+* with tee into an empty pipe, which is spliced to each output but the last
+* one, and then the input itself is spliced to the last output. It returns
+* -1 with errno set to EINVAL before moving anything if an output cannot
+* be spliced to.
+*/
+int teePipe(int in, int outputs[], int count) {
+	int scratch[2] = { -1, -1 };
+	ssize_t n, moved;
+
+	for (int i = 0; i < count; i++) {
+		struct stat sb;
+		if (fstat(outputs[i], &sb) == -1) return -1;
+		if ((!S_ISFIFO(sb.st_mode) && !S_ISREG(sb.st_mode)) || (fcntl(outputs[i], F_GETFL) & O_APPEND)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (count > 1) {
+		if (pipe2(scratch, O_CLOEXEC) == -1) return -1;
+		// An empty pipe as large as the input takes all that tee gives it
+		fcntl(scratch[1], F_SETPIPE_SZ, fcntl(in, F_GETPIPE_SZ));
+	}
+
+	while (TRUE) {
+		if (count > 1) n = tee(in, scratch[1], MOVE_CHUNK_SIZE, 0);
+		else n = splice(in, NULL, outputs[0], NULL, MOVE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n == -1 && errno == EINTR && !lineInterrupted) continue;
+		if (n <= 0 || count == 1) {
+			if (n <= 0) break;
+			movedBytes += n;
+			continue;
+		}
+
+		// The copy goes to each output but the last, duplicated again
+		// from the input for each one after the first
+		for (int i = 0; i < count - 1 && n > 0; i++) {
+			if (i > 0 && tee(in, scratch[1], n, 0) != n) n = -1;
+			for (moved = 0; n > 0 && moved < n;) {
+				ssize_t m = splice(scratch[0], NULL, outputs[i], NULL, n - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+				if (m == -1 && errno == EINTR && !lineInterrupted) continue;
+				if (m <= 0) n = -1;
+				else moved += m;
+			}
+		}
+		// The input itself goes to the last output
+		for (moved = 0; n > 0 && moved < n;) {
+			ssize_t m = splice(in, NULL, outputs[count - 1], NULL, n - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (m == -1 && errno == EINTR && !lineInterrupted) continue;
+			if (m <= 0) n = -1;
+			else moved += m;
+		}
+		if (n > 0) movedBytes += n;
+		if (n == -1) break;
+	}
+	if (scratch[0] != -1) {
+		close(scratch[0]);
+		close(scratch[1]);
+	}
+	return n == 0 ? 0 : -1;
+}
+
+/**
+* Builtin cat: writes the files, or the standard input when there are none
+* or for '-', to the standard output. It runs in the shell, so 'cat FILE |'
+* starts the pipeline without a process of its own.
+*/
+int catCommand(char* args[]) {
+	int status = 0;
+	int i = 1;
+
+	fflush(stdout);
+	do {
+		const char* name = args[i] != NULL ? args[i] : "-";
+		int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+
+		if (fd == -1 || moveData(fd, STDOUT_FILENO) == -1) {
+			if (errno != EPIPE) fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+			status = 1;
+		}
+		if (fd > STDERR_FILENO) close(fd);
+		if (lineInterrupted) return 130;
+	} while (args[i] != NULL && args[++i] != NULL);
+	return status;
+}
+
+/**
+* Builtin tee: copies the standard input to the standard output and to
+* every file, appending to them with -a. When the input is a pipe the data
+* never goes through the shell.
+*/
+int teeCommand(char* args[]) {
+	int append = args[1] != NULL && strcmp(args[1], "-a") == 0;
+	int first = append ? 2 : 1;
+	int count = 1;
+	int status = 0;
+	int outputs[TEE_MAX_FILES + 1];
+	struct stat sb;
+	ssize_t n = 0;
+	int piped;
+
+	fflush(stdout);
+	outputs[0] = STDOUT_FILENO;
+	for (int i = first; args[i] != NULL; i++) {
+		if (count > TEE_MAX_FILES) {
+			fprintf(stderr, "tee: usage: tee [-a] FILE... (at most %d files)\n", TEE_MAX_FILES);
+			status = 1;
+			break;
+		}
+		outputs[count] = open(args[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+		if (outputs[count] == -1) {
+			fprintf(stderr, "tee: %s: %s\n", args[i], strerror(errno));
+			status = 1;
+		}
+		else count++;
+	}
+
+	piped = fstat(STDIN_FILENO, &sb) == 0 && S_ISFIFO(sb.st_mode);
+	if (piped) n = teePipe(STDIN_FILENO, outputs, count);
+	if (!piped || (n == -1 && errno == EINVAL)) {
+		// Without a pipe the blocks are read once and written to each output
+		char* buffer = malloc(MOVE_BUFFER_SIZE);
+		if (buffer == NULL) n = -1;
+		while (buffer != NULL && ((n = read(STDIN_FILENO, buffer, MOVE_BUFFER_SIZE)) > 0 ||
+			(n == -1 && errno == EINTR && !lineInterrupted))) {
+			for (int i = 0; i < count && n > 0; i++)
+				if (writeAll(outputs[i], buffer, n) == -1) n = -1;
+			// A write error is not lost to the next read
+			if (n == -1) break;
+		}
+		free(buffer);
+	}
+	if (n == -1 && errno != EPIPE && !lineInterrupted) {
+		perror("tee");
+		status = 1;
+	}
+	for (int i = 1; i < count; i++) close(outputs[i]);
+	return lineInterrupted ? 130 : status;
+}
+
+/**
+ * BUILTIN COMMANDS
+ */
+
+/**
+* Builtin exit: quits the shell
+*/
+int exitCommand(char* args[]) {
+	exit(args[1] != NULL ? atoi(args[1]) : lastStatus);
+}
+
+/**
+* Method used to check the value of the pipesize option: a pipe is given
+* that capacity, which the kernel rounds up. It returns the capacity the
+* pipes will have, or -1 if they cannot have it.
+*/
+int checkPipeSize(long size) {
+	int pipefd[2];
+	int granted;
+
+	if (size == 0) return 0;
+	if (size < 0 || size > INT_MAX || pipe2(pipefd, O_CLOEXEC) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	granted = fcntl(pipefd[1], F_SETPIPE_SZ, (int)size);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return granted;
+}
+
+/**
+* Builtin set: 'set -o NAME' turns an option on, 'set +o NAME' turns it off
+* and 'set -o' alone lists the options. An option with a value is set with
+* 'set -o NAME=VALUE', the sizes can end in K or M.
+*/
+int setCommand(char* args[]) {
+	static const struct shellOption options[] = {
+		{ "globsort", &optionGlobSort, NULL },
+		{ "pipefail", &optionPipefail, NULL },
+		{ "pipesize", &optionPipeSize, checkPipeSize },
+		{ "pipestats", &optionPipeStats, NULL },
+	};
+	int count = sizeof(options) / sizeof(options[0]);
+	char* value;
+	int i;
+
+	if (args[1] == NULL || (strcmp(args[1], "-o") != 0 && strcmp(args[1], "+o") != 0)) {
+		fprintf(stderr, "set: usage: set -o [NAME[=VALUE]] | set +o NAME\n");
+		return 2;
+	}
+	if (args[2] == NULL) {
+		for (i = 0; i < count; i++) {
+			if (options[i].check != NULL) {
+				if (*options[i].value == 0) printf("%-15s default\n", options[i].name);
+				else printf("%-15s %d\n", options[i].name, *options[i].value);
+			}
+			else printf("%-15s %s\n", options[i].name, *options[i].value ? "on" : "off");
+		}
+		return 0;
+	}
+	if ((value = strchr(args[2], '=')) != NULL) *value++ = '\0';
+	for (i = 0; i < count; i++) {
+		if (strcmp(args[2], options[i].name) != 0) continue;
+		// Turning off an option with a value gives it back its default
+		if (options[i].check == NULL || args[1][0] == '+') {
+			*options[i].value = args[1][0] == '-';
+			return 0;
+		}
+		if (value == NULL) {
+			fprintf(stderr, "set: %s: needs a value, set -o %s=VALUE\n", args[2], args[2]);
+			return 2;
+		}
+		char* end;
+		long number = strtol(value, &end, 10);
+		if (*end == 'K' || *end == 'k') number <<= 10, end++;
+		else if (*end == 'M' || *end == 'm') number <<= 20, end++;
+		if (*end != '\0' || (number = options[i].check(number)) == -1) {
+			fprintf(stderr, "set: %s: %s: %s\n", args[2], value, *end != '\0' ? "invalid number" : strerror(errno));
+			return 1;
+		}
+		*options[i].value = number;
+		return 0;
+	}
+	fprintf(stderr, "set: %s: invalid option name\n", args[2]);
+	return 2;
+}
+
+/**
+* Builtin pwd: prints the current directory
+*/
+int pwdCommand(char* args[]) {
+	printf("%s\n", currentDirectory);
+	return 0;
+}
+
+/**
+* Builtin true: does nothing, successfully
+*/
+int trueCommand(char* args[]) {
+	return 0;
+}
+
+/**
+* Builtin false: does nothing, unsuccessfully
+*/
+int falseCommand(char* args[]) {
+	return 1;
+}
+
+/**
+* Builtin help
+*/
+int helpCommand(char* args[]) {
+	Help(args);
+	return 0;
+}
+
+/**
+* Builtin history: prints the recent commands, or the last N with 'history N'
+*/
+int historyCommand(char* args[]) {
+	int count = history.count < HISTORY_RING_SIZE ? history.count : HISTORY_RING_SIZE;
+	char* entry;
+
+	if (args[1] != NULL) count = atoi(args[1]);
+	if (count > history.count) count = history.count;
+	for (int i = history.count - count + 1; i <= history.count; i++) {
+		if ((entry = recallHistory(i)) != NULL) printf("%5d  %s\n", i, entry);
+	}
+	return 0;
+}
+
+/**
+* Table of the builtins, sorted by name so it can be searched with bsearch.
+* Every builtin declares if it may run inside the shell process when it is
+* a pipeline stage, and if its standard input and output can be redirected.
+*/
+static const struct builtin builtins[] = {
+	{ "bg", bgCommand, 0 },
+	{ "cat", catCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "cd", changeDirectory, 0 },
+	{ "exit", exitCommand, 0 },
+	{ "export", exportCommand, BUILTIN_REDIRECT },
+	{ "false", falseCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "fg", fgCommand, 0 },
+	{ "hash", hashCommand, BUILTIN_REDIRECT },
+	{ "help", helpCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "history", historyCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "jobs", jobsCommand, BUILTIN_REDIRECT },
+	{ "parallel", parallelCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "pwd", pwdCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "rehash", rehashCommand, 0 },
+	{ "set", setCommand, BUILTIN_REDIRECT },
+	{ "spawnstat", spawnStatCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "tee", teeCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "trace", traceCommand, BUILTIN_REDIRECT },
+	{ "true", trueCommand, BUILTIN_INPROCESS | BUILTIN_REDIRECT },
+	{ "unset", unsetCommand, 0 },
+	{ "wait", waitCommand, 0 },
+};
+
+/**
+* Comparison used by bsearch over the builtin table
+*/
+int compareBuiltin(const void* name, const void* builtin) {
+	return strcmp((const char*)name, ((const struct builtin*)builtin)->name);
+}
+
+/**
+* Method used to find the builtin called name, NULL if there is none
+*/
+const struct builtin* findBuiltin(const char* name) {
+	return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]), sizeof(struct builtin),
+		compareBuiltin);
+}
+
+/**
+* Method used to know if a command is implemented by the shell itself
+*/
+int isBuiltin(char* name) {
+	return findBuiltin(name) != NULL;
+}
+
+/**
+* Method used to know if a token is a redirection operator and which one.
+* Operators are interned by the lexer, so their address is enough.
+*/
+int redirectionType(const char* token) {
+	if (token == TOKEN_INPUT) return REDIRECT_INPUT;
+	if (token == TOKEN_OUTPUT) return REDIRECT_OUTPUT;
+	if (token == TOKEN_APPEND) return REDIRECT_APPEND;
+	return REDIRECT_NONE;
+}
+
+/**
+* Method used to apply redirections to the shell process itself. The
+* descriptors they replace are saved, to be given back by restoreShell.
+*/
+int redirectShell(struct redirection* redirections, int saved[2]) {
+	struct spawnAttr attr;
+
+	fflush(stdout);
+	saved[0] = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+	saved[1] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	initSpawnAttr(&attr);
+	attr.redirections = redirections;
+	if (applyRedirections(&attr) == -1) {
+		restoreShell(saved);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+* Method used to give back the descriptors saved by redirectShell
+*/
+void restoreShell(int saved[2]) {
+	fflush(stdout);
+	dup2(saved[0], STDIN_FILENO);
+	dup2(saved[1], STDOUT_FILENO);
+	close(saved[0]);
+	close(saved[1]);
+}
+
+/**
+* Method used to run a builtin in the shell process. When the builtin
+* accepts redirections its standard input and output are swapped with the
+* files while it runs, and given back afterwards.
+*/
+int runBuiltin(const struct builtin* builtin, struct command* command) {
+	int redirected = command->redirections != NULL && (builtin->flags & BUILTIN_REDIRECT);
+	int saved[2];
+	int status;
+
+	if (redirected && redirectShell(command->redirections, saved) == -1) return 1;
+	status = builtin->handler(command->argv);
+	if (redirected) restoreShell(saved);
+	return status;
+}
+
+/**
+* Method used to handle a command of the tree that is not part of a longer
+* pipeline. Builtins are found in the table and run by the shell itself
+* (always in the foreground), ifs are executed in the shell with their
+* redirections, and anything else is launched as a program.
+*/
+int commandHandler(struct command* command, int background) {
+	const struct builtin* builtin;
+	int saved[2];
+	int status = 0;
+
+	// An if, or a command made only of assignments and redirections, which
+	// create or truncate the files
+	if (command->argc == 0) {
+		if (redirectShell(command->redirections, saved) == -1) return 1;
+		if (command->compound != NULL) status = executeNode(command->compound);
+		else {
+			// Assignments end with the status of their last substitution
+			assignVariables(command);
+			status = substitutionStatus;
+		}
+		restoreShell(saved);
+		return status;
+	}
+
+	if ((builtin = findBuiltin(command->argv[0])) != NULL) return runBuiltin(builtin, command);
+	return launchProg(command, background);
+}
+
+/**
+* Method executed inside the forked child of a pipeline stage run by the
+* shell code (a builtin or an if), after its redirections were applied.
+* The child does no job control of its own.
+*/
+void executeStage(struct command* command) {
+	int status = 0;
+
+	GBSH_IS_INTERACTIVE = 0;
+	forgetJobs();
+	if (command->compound != NULL) status = executeNode(command->compound);
+	else if (command->argc > 0) status = findBuiltin(command->argv[0])->handler(command->argv);
+	fflush(stdout);
+	_exit(status);
+}
+
+/**
+* Method used to run a builtin pipeline stage inside the shell process. Its
+* standard input and output are swapped with the descriptors of the stage
+* while it runs. SIGPIPE is ignored meanwhile, so a reader that finished
+* early makes the builtin fail instead of killing the shell.
+*/
+int runBuiltinStage(const struct builtin* builtin, struct command* command, int inFd, int outFd) {
+	int savedIn = -1;
+	int savedOut = -1;
+	int status;
+	void (*oldPipeHandler)(int);
+
+	fflush(stdout);
+	if (inFd != -1) {
+		savedIn = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+		dup2(inFd, STDIN_FILENO);
+	}
+	if (outFd != -1) {
+		savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+		dup2(outFd, STDOUT_FILENO);
+	}
+	oldPipeHandler = signal(SIGPIPE, SIG_IGN);
+
+	status = runBuiltin(builtin, command);
+
+	fflush(stdout);
+	clearerr(stdout);
+	signal(SIGPIPE, oldPipeHandler);
+	if (savedIn != -1) {
+		dup2(savedIn, STDIN_FILENO);
+		close(savedIn);
+	}
+	if (savedOut != -1) {
+		dup2(savedOut, STDOUT_FILENO);
+		close(savedOut);
+	}
+	return status;
+}
+
+/**
+* Method used to launch a pipeline of numStages commands. All the stages are
+* created before waiting for any of them, so they run at the same time and
+* the data streams between them. Every child goes into one process group,
+* which receives the terminal while the pipeline runs in the foreground.
+*
+* Builtins that allow it run in the shell process without forking: the ones
+* followed only by children, which are already running to consume their
+* output, and the ones at the end of the pipeline made only of builtins. Two
+* neighbour builtins of that tail are connected with a memory file instead
+* of a pipe, so the first one can finish before the second one starts.
+*/
+int launchPipeline(struct pipeline* pipeline) {
+	struct command* stages = pipeline->stages;
+	int numStages = pipeline->count;
+	int background = pipeline->background;
+	pid_t pids[numStages];
+	const struct builtin* builtin[numStages];
+	int inProcess[numStages];
+	int readFd[numStages];
+	int writeFd[numStages];
+	int memoryEdge[numStages];
+	int statuses[numStages];
+	int childStage[numStages];
+	int childStatuses[numStages];
+	struct stageTime childTimes[numStages];
+	struct stageTime* times = pipeline->timed || trace.fd != -1 || optionPipeStats ?
+		arenaAlloc(&lineArena, numStages * sizeof(struct stageTime)) : NULL;
+	int capacities[numStages];
+	long long moved = 0;
+	struct timespec start;
+	int spawnedSuffix = 1;
+	int inProcessSuffix = 1;
+	int launched = 0;
+	int failed = 0;
+	pid_t pgid = 0;
+	struct spawnAttr attr;
+	sigset_t oldMask;
+	int i, j;
+
+	// We decide from the end which builtins can run in the shell process
+	for (i = numStages - 1; i >= 0; i--) {
+		builtin[i] = stages[i].argc > 0 ? findBuiltin(stages[i].argv[0]) : NULL;
+		inProcess[i] = !background && builtin[i] != NULL && (builtin[i]->flags & BUILTIN_INPROCESS) &&
+			(spawnedSuffix || inProcessSuffix);
+		spawnedSuffix = spawnedSuffix && !inProcess[i];
+		inProcessSuffix = inProcessSuffix && inProcess[i];
+	}
+
+	// The descriptors between the stages are all created before launching
+	// them. They are close-on-exec so no child keeps another stage's pipe
+	// open after its own ends were moved to 0 and 1.
+	for (i = 0; i < numStages; i++) {
+		readFd[i] = -1;
+		writeFd[i] = -1;
+		memoryEdge[i] = 0;
+		capacities[i] = 0;
+	}
+	for (i = 0; i < numStages - 1 && !failed; i++) {
+		int pipefd[2];
+		if (inProcess[i] && inProcess[i + 1]) {
+			memoryEdge[i] = 1;
+			pipefd[0] = pipefd[1] = memfd_create("pipeline", MFD_CLOEXEC);
+			if (pipefd[0] == -1) failed = 1;
+		}
+		else if (pipe2(pipefd, O_CLOEXEC) == -1) failed = 1;
+		else capacities[i] = sizePipe(pipefd[1]);
+		if (!failed) {
+			writeFd[i] = pipefd[1];
+			readFd[i + 1] = pipefd[0];
+		}
+	}
+	if (failed) {
+		perror("pipe");
+		for (i = 0; i < numStages; i++) {
+			if (readFd[i] != -1 && !(i > 0 && memoryEdge[i - 1])) close(readFd[i]);
+			if (writeFd[i] != -1) close(writeFd[i]);
+		}
+		return 1;
+	}
+
+	blockChildSignals(&oldMask);
+	if (times != NULL) clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// First the children are launched, from left to right
+	for (i = 0; i < numStages; i++) {
+		if (inProcess[i]) continue;
+
+		initSpawnAttr(&attr);
+		attr.inFd = readFd[i];
+		attr.outFd = writeFd[i];
+		attr.pgid = pgid;
+		attr.redirections = stages[i].redirections;
+		attr.assignments = stages[i].assignments;
+		attr.foreground = !background;
+
+		childStage[launched] = i;
+		if (times != NULL) {
+			memset(&childTimes[launched], 0, sizeof(struct stageTime));
+			clock_gettime(CLOCK_MONOTONIC, &childTimes[launched].start);
+			childTimes[launched].end = childTimes[launched].start;
+		}
+		if (builtin[i] == NULL && stages[i].argc > 0) {
+			pids[launched] = spawnProcess(stages[i].argv, &attr);
+			if (pids[launched] == -1) childStatuses[launched] = spawnFailureStatus(errno);
+		}
+		else {
+			// Builtins that need their own process run in a forked child,
+			// which closes the descriptors of the other stages
+			pids[launched] = forkProcess(&attr);
+			if (pids[launched] == -1) childStatuses[launched] = 1;
+			if (pids[launched] == 0) {
+				for (j = 0; j < numStages; j++) {
+					if (j == i) continue;
+					if (readFd[j] != -1 && readFd[j] != writeFd[i]) close(readFd[j]);
+					if (writeFd[j] != -1 && writeFd[j] != readFd[i] && writeFd[j] != readFd[j + 1])
+						close(writeFd[j]);
+				}
+				executeStage(&stages[i]);
+			}
+		}
+
+		if (times != NULL) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			childTimes[launched].spawnMicros = elapsedSeconds(&childTimes[launched].start, &now) * 1e6;
+			childTimes[launched].pid = pids[launched];
+		}
+		if (pids[launched] > 0 && pgid == 0) pgid = pids[launched];
+		if (readFd[i] != -1) close(readFd[i]);
+		if (writeFd[i] != -1) close(writeFd[i]);
+		launched++;
+	}
+
+	if (background) {
+		struct job* job = pgid != 0 ? addJob(pgid, pids, childStatuses, launched, describePipeline(pipeline)) : NULL;
+		if (job != NULL) printf("[%d] Process created with PID: %d\n", job->id, pgid);
+		if (launched > 0) lastBackground = pids[launched - 1];
+		if (times != NULL) {
+			for (i = 0; i < launched; i++) times[childStage[i]] = childTimes[i];
+			tracePipeline(pipeline, times, childStatuses, &start);
+		}
+		sigprocmask(SIG_SETMASK, &oldMask, NULL);
+		return 0;
+	}
+
+	// Then the builtins run in order inside the shell, while the children
+	// consume what they write
+	for (i = 0; i < numStages; i++) {
+		if (!inProcess[i]) continue;
+
+		if (times != NULL) {
+			memset(&times[i], 0, sizeof(struct stageTime));
+			clock_gettime(CLOCK_MONOTONIC, &times[i].start);
+			getrusage(RUSAGE_SELF, &times[i].usage);
+			times[i].pid = getpid();
+			if (optionPipeStats) readProcessIo(getpid(), &times[i]);
+			moved = movedBytes;
+		}
+		statuses[i] = runBuiltinStage(builtin[i], &stages[i], readFd[i], writeFd[i]);
+		if (times != NULL) measureShellStage(&times[i], 0);
+		if (times != NULL && optionPipeStats) {
+			struct stageTime before = times[i];
+			readProcessIo(getpid(), &times[i]);
+			// What the kernel moved for the builtin is not counted in /proc
+			times[i].readBytes -= before.readBytes - (movedBytes - moved);
+			times[i].writtenBytes -= before.writtenBytes - (movedBytes - moved);
+		}
+
+		if (readFd[i] != -1) close(readFd[i]);
+		// A memory file is read by the next builtin from its beginning
+		if (memoryEdge[i]) lseek(writeFd[i], 0, SEEK_SET);
+		else if (writeFd[i] != -1) close(writeFd[i]);
+	}
+
+	// The children are reaped as a unit, and the status of the pipeline
+	// comes from the status of all its stages
+	if (launched > 0) waitForeground(pids, launched, pgid == 0 ? GBSH_PGID : pgid, childStatuses, pipeline,
+		times != NULL ? childTimes : NULL);
+	for (i = 0; i < launched; i++) {
+		statuses[childStage[i]] = childStatuses[i];
+		if (times != NULL) times[childStage[i]] = childTimes[i];
+	}
+	if (pipeline->timed) reportTimes(pipeline, times, &start);
+	if (optionPipeStats && numStages > 1) reportPipeStats(pipeline, times, capacities);
+	if (trace.fd != -1) tracePipeline(pipeline, times, statuses, &start);
+
+	sigprocmask(SIG_SETMASK, &oldMask, NULL);
+	return pipelineStatus(statuses, numStages);
+}
+
+/**
+* Method used to execute a command tree. It walks the tree once: lists run
+* in order, '&&' and '||' only run their right side depending on the status
+* of the left one, and ifs run one of their branches. It returns the status
+* of the tree, which is also kept in lastStatus for $?.
+*/
+int executeNode(struct node* node) {
+	struct timespec start;
+	int status = 0;
+
+	if (node == NULL) return 0;
+	// The pipelines write their own, more detailed, record
+	if (trace.fd != -1 && node->type != NODE_PIPELINE) clock_gettime(CLOCK_MONOTONIC, &start);
+
+	switch (node->type) {
+	case NODE_PIPELINE:
+		status = pipeHandler(node->pipeline);
+		break;
+	case NODE_SEQUENCE:
+		executeNode(node->left);
+		status = executeNode(node->right);
+		break;
+	case NODE_AND:
+		status = executeNode(node->left);
+		if (status == 0) status = executeNode(node->right);
+		break;
+	case NODE_OR:
+		status = executeNode(node->left);
+		if (status != 0) status = executeNode(node->right);
+		break;
+	case NODE_IF:
+		if (executeNode(node->left) == 0) status = executeNode(node->right);
+		else status = executeNode(node->elseBranch);
+		break;
+	case NODE_BACKGROUND:
+		status = launchSubshell(node->left);
+		break;
+	}
+	if (trace.fd != -1 && node->type != NODE_PIPELINE) traceNode(node, status, &start);
+	lastStatus = status;
+	return status;
+}
+
+/**
+* Method used to run a command tree in a forked copy of the shell, in the
+* background. The subshell does no job control: its commands stay in its
+* process group and never take the terminal.
+*/
+int launchSubshell(struct node* node) {
+	struct spawnAttr attr;
+	struct job* job;
+	sigset_t oldMask;
+	int status = 0;
+	pid_t child;
+
+	initSpawnAttr(&attr);
+	blockChildSignals(&oldMask);
+	child = forkProcess(&attr);
+	if (child == 0) {
+		GBSH_IS_INTERACTIVE = 0;
+		forgetJobs();
+		_exit(executeNode(node));
+	}
+	if (child > 0) {
+		job = addJob(child, &child, &status, 1, describeNode(node));
+		printf("[%d] Process created with PID: %d\n", job != NULL ? job->id : 0, child);
+		lastBackground = child;
+	}
+	sigprocmask(SIG_SETMASK, &oldMask, NULL);
+	return child > 0 ? 0 : 1;
+}
+
+/**
+* Method used to know how many seconds passed between two instants
+*/
+double elapsedSeconds(struct timespec* start, struct timespec* end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+* Method used to measure what the shell itself spends, for the stages that
+* run inside it: the usage from before is turned into the difference
+*/
+void measureShellStage(struct stageTime* time, int children) {
+	struct rusage now;
+
+	clock_gettime(CLOCK_MONOTONIC, &time->end);
+	getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &now);
+	timersub(&now.ru_utime, &time->usage.ru_utime, &time->usage.ru_utime);
+	timersub(&now.ru_stime, &time->usage.ru_stime, &time->usage.ru_stime);
+	time->usage.ru_maxrss = now.ru_maxrss;
+	time->usage.ru_nvcsw = now.ru_nvcsw - time->usage.ru_nvcsw;
+	time->usage.ru_nivcsw = now.ru_nivcsw - time->usage.ru_nivcsw;
+	time->usage.ru_minflt = now.ru_minflt - time->usage.ru_minflt;
+	time->usage.ru_majflt = now.ru_majflt - time->usage.ru_majflt;
+}
+
+/**
+* Method used to print what each stage of a timed pipeline spent and the
+* total: wall time from its launch to its end, user and system time, the
+* biggest resident size and the context switches and page faults
+*/
+void reportTimes(struct pipeline* pipeline, struct stageTime times[], struct timespec* start) {
+	struct timespec end = *start;
+	struct rusage total;
+	int i;
+
+	memset(&total, 0, sizeof(total));
+	fprintf(stderr, "%-5s %-16s %9s %9s %9s %9s %7s %7s %8s %7s\n",
+		"stage", "command", "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "minflt", "majflt");
+	for (i = 0; i < pipeline->count; i++) {
+		struct command* stage = &pipeline->stages[i];
+		struct rusage* usage = &times[i].usage;
+
+		fprintf(stderr, "%-5d %-16.16s %8.3fs %8.3fs %8.3fs %8ldK %7ld %7ld %8ld %7ld\n", i + 1,
+			stage->compound != NULL ? "if" : stage->argc > 0 ? stage->argv[0] : "",
+			elapsedSeconds(&times[i].start, &times[i].end),
+			usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+			usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+			usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw, usage->ru_minflt, usage->ru_majflt);
+
+		timeradd(&total.ru_utime, &usage->ru_utime, &total.ru_utime);
+		timeradd(&total.ru_stime, &usage->ru_stime, &total.ru_stime);
+		if (usage->ru_maxrss > total.ru_maxrss) total.ru_maxrss = usage->ru_maxrss;
+		total.ru_nvcsw += usage->ru_nvcsw;
+		total.ru_nivcsw += usage->ru_nivcsw;
+		total.ru_minflt += usage->ru_minflt;
+		total.ru_majflt += usage->ru_majflt;
+		if (elapsedSeconds(&end, &times[i].end) > 0) end = times[i].end;
+	}
+	fprintf(stderr, "%-5s %-16s %8.3fs %8.3fs %8.3fs %8ldK %7ld %7ld %8ld %7ld\n", "total", "",
+		elapsedSeconds(start, &end),
+		total.ru_utime.tv_sec + total.ru_utime.tv_usec / 1e6,
+		total.ru_stime.tv_sec + total.ru_stime.tv_usec / 1e6,
+		total.ru_maxrss, total.ru_nvcsw, total.ru_nivcsw, total.ru_minflt, total.ru_majflt);
+}
+
+/**
+* Method used to read how many bytes a process read and wrote, from its
+* entry in /proc. An ended process is read before it is reaped.
+*/
+void readProcessIo(pid_t pid, struct stageTime* time) {
+	char path[64];
+	char text[512];
+	char* field;
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return;
+	n = read(fd, text, sizeof(text) - 1);
+	close(fd);
+	if (n <= 0) return;
+	text[n] = '\0';
+	if ((field = strstr(text, "rchar: ")) != NULL) time->readBytes = strtoll(field + 7, NULL, 10);
+	if ((field = strstr(text, "wchar: ")) != NULL) time->writtenBytes = strtoll(field + 7, NULL, 10);
+}
+
+/**
+* Method used to give a pipe of a pipeline the capacity of the pipesize
+* option. It returns the capacity the pipe has.
+*/
+int sizePipe(int fd) {
+	if (optionPipeSize > 0) fcntl(fd, F_SETPIPE_SZ, optionPipeSize);
+	return fcntl(fd, F_GETPIPE_SZ);
+}
+
+/**
+* Method used to print the statistics of the pipes of a pipeline: for each
+* stage the bytes it read and wrote, the capacity of the pipe to the next
+* one, and how much of its time it was blocked and how many times. The
+* busiest stage is the one the others wait for.
+*/
+void reportPipeStats(struct pipeline* pipeline, struct stageTime times[], int capacities[]) {
+	int busiest = 0;
+	double busiestShare = -1;
+
+	fprintf(stderr, "%-5s %-16s %9s %9s %8s %8s %12s %12s %9s\n",
+		"stage", "command", "real", "cpu", "blocked", "waits", "read", "written", "pipe");
+	for (int i = 0; i < pipeline->count; i++) {
+		struct command* stage = &pipeline->stages[i];
+		struct rusage* usage = &times[i].usage;
+		double real = elapsedSeconds(&times[i].start, &times[i].end);
+		double cpu = usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6 +
+			usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+		double share = real > 0 ? cpu / real : 1;
+		char pipe[16];
+
+		if (share > 1) share = 1;
+		if (share > busiestShare) {
+			busiestShare = share;
+			busiest = i;
+		}
+		if (i == pipeline->count - 1) strcpy(pipe, "-");
+		else if (capacities[i] <= 0) strcpy(pipe, "memory");
+		else snprintf(pipe, sizeof(pipe), "%d", capacities[i]);
+		fprintf(stderr, "%-5d %-16.16s %8.3fs %8.3fs %7.1f%% %8ld %12lld %12lld %9s\n", i + 1,
+			stage->compound != NULL ? "if" : stage->argc > 0 ? stage->argv[0] : "",
+			real, cpu, (1 - share) * 100, usage->ru_nvcsw, times[i].readBytes, times[i].writtenBytes, pipe);
+	}
+	fprintf(stderr, "busiest: stage %d (%s), running %.1f%% of its time\n", busiest + 1,
+		pipeline->stages[busiest].compound != NULL ? "if" :
+		pipeline->stages[busiest].argc > 0 ? pipeline->stages[busiest].argv[0] : "", busiestShare * 100);
+}
+
+/**
+* Method used to run a timed or traced command that has to run in the
+* shell, like cd. What it spends is the difference of the usage of the
+* shell and of its children before and after it.
+*/
+int measureShellCommand(struct pipeline* pipeline) {
+	struct stageTime times[2];
+	int status;
+
+	memset(times, 0, sizeof(times));
+	clock_gettime(CLOCK_MONOTONIC, &times[0].start);
+	getrusage(RUSAGE_SELF, &times[0].usage);
+	times[1] = times[0];
+	getrusage(RUSAGE_CHILDREN, &times[1].usage);
+
+	status = commandHandler(&pipeline->stages[0], pipeline->background);
+
+	measureShellStage(&times[0], 0);
+	measureShellStage(&times[1], 1);
+	timeradd(&times[0].usage.ru_utime, &times[1].usage.ru_utime, &times[0].usage.ru_utime);
+	timeradd(&times[0].usage.ru_stime, &times[1].usage.ru_stime, &times[0].usage.ru_stime);
+	times[0].usage.ru_nvcsw += times[1].usage.ru_nvcsw;
+	times[0].usage.ru_nivcsw += times[1].usage.ru_nivcsw;
+	times[0].usage.ru_minflt += times[1].usage.ru_minflt;
+	times[0].usage.ru_majflt += times[1].usage.ru_majflt;
+	times[0].pid = getpid();
+	if (pipeline->timed) reportTimes(pipeline, times, &times[0].start);
+	if (trace.fd != -1) tracePipeline(pipeline, times, &status, &times[0].start);
+	return status;
+}
+
+/**
+* Method used to run a pipeline of the command tree
+*/
+int pipeHandler(struct pipeline* pipeline) {
+	struct command* command;
+
+	// The tree is left untouched, the pipeline that runs is its expansion
+	pipeline = expandPipeline(pipeline);
+	command = &pipeline->stages[0];
+
+	// A timed, traced or measured pipeline is launched as a whole to measure its
+	// stages, unless it has to run in the shell, like cd, an if or an
+	// assignment
+	if ((pipeline->timed && !pipeline->background) || trace.fd != -1 ||
+		(optionPipeStats && pipeline->count > 1 && !pipeline->background)) {
+		const struct builtin* builtin = command->argc > 0 ? findBuiltin(command->argv[0]) : NULL;
+		if (pipeline->count == 1 && !pipeline->background &&
+			(command->argc == 0 || (builtin != NULL && !(builtin->flags & BUILTIN_INPROCESS))))
+			return measureShellCommand(pipeline);
+		return launchPipeline(pipeline);
+	}
+
+	// A command without pipes is executed directly, unless it is an if
+	// that has to go to the background
+	if (pipeline->count == 1 && !(pipeline->background && command->compound != NULL))
+		return commandHandler(command, pipeline->background);
+	return launchPipeline(pipeline);
+}
+
+/**
+ * EXPANSION
+ */
+
+/**
+* Method used to know if the character after a '$' starts an expansion
+*/
+int startsExpansion(char c) {
+	return c == '_' || c == '{' || c == '?' || c == '$' || c == '!' || isalpha((unsigned char)c);
+}
+
+/**
+* Method used to know if the first length characters of a word are the name
+* of a variable
+*/
+int isName(const char* word, size_t length) {
+	if (length == 0 || isdigit((unsigned char)word[0])) return 0;
+	for (size_t i = 0; i < length; i++)
+		if (word[i] != '_' && !isalnum((unsigned char)word[i])) return 0;
+	return 1;
+}
+
+/**
+* Method used to know if a word is an assignment, NAME=VALUE
+*/
+int isAssignment(const char* word) {
+	const char* equals = strchr(word, '=');
+
+	return equals != NULL && isName(word, equals - word);
+}
+
+/**
+* Method used to read the expansion that follows a '$' marker. It stores
+* its value, NULL when the variable is not set, and returns where the
+* expansion ends in the word.
+*/
+const char* expandVariable(const char* src, const char** value) {
+	static char number[24];
+	char name[256];
+	size_t length = 0;
+	int braced = *src == '{';
+
+	if (braced) src++;
+	*value = number;
+	switch (*src) {
+	case '?':
+		snprintf(number, sizeof(number), "%d", lastStatus);
+		src++;
+		break;
+	case '$':
+		snprintf(number, sizeof(number), "%d", (int)GBSH_PID);
+		src++;
+		break;
+	case '!':
+		if (lastBackground > 0) snprintf(number, sizeof(number), "%d", (int)lastBackground);
+		else *value = NULL;
+		src++;
+		break;
+	default:
+		while (*src == '_' || isalnum((unsigned char)*src)) {
+			if (length < sizeof(name) - 1) name[length++] = *src;
+			src++;
+		}
+		name[length] = '\0';
+		*value = getVariable(name);
+	}
+	if (braced && *src == '}') src++;
+	return src;
+}
+
+/**
+* Method used to read what a command substitution prints, with reads as
+* large as the free space of the buffer, which doubles when it is full
+*/
+size_t captureOutput(int fd, char** buffer, size_t* capacity) {
+	size_t length = 0;
+	ssize_t n;
+
+	while (TRUE) {
+		if (length == *capacity) {
+			*capacity = *capacity == 0 ? SUBSTITUTION_READ_SIZE : *capacity * 2;
+			*buffer = realloc(*buffer, *capacity);
+		}
+		n = read(fd, *buffer + length, *capacity - length);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		length += n;
+	}
+	return length;
+}
+
+/**
+* Method used to run the command of a substitution, $(command) or
+* `command`, and get what it prints without its trailing newlines. A
+* builtin that can run in the shell writes to a memory file without a
+* fork; a program is spawned like launchProg does, writing to a pipe; and
+* anything else runs in a forked subshell.
+*/
+char* substituteCommand(const char* text, size_t length) {
+	// The words of the substitution are expanded while the word that
+	// contains it is, so it gets a buffer of its own
+	char* outerBuffer = expansionBuffer;
+	size_t outerLength = expansionLength;
+	size_t outerCapacity = expansionCapacity;
+	int outerExpansions = lineExpansions;
+	char* line = arenaAlloc(&lineArena, length + 2);
+	char* output = NULL;
+	size_t capacity = 0;
+	size_t size = 0;
+	struct node* root = NULL;
+	struct command* command = NULL;
+	const struct builtin* builtin = NULL;
+	int status = 0;
+
+	memcpy(line, text, length);
+	line[length] = '\n';
+	line[length + 1] = '\0';
+	expansionBuffer = NULL;
+	expansionLength = expansionCapacity = 0;
+
+	if (tokenize(line) > 0 && (root = parseLine(lineTokens)) == NULL) status = 2;
+	if (root != NULL && root->type == NODE_PIPELINE && root->pipeline->count == 1 && !root->pipeline->background) {
+		root->pipeline = expandPipeline(root->pipeline);
+		command = &root->pipeline->stages[0];
+		if (command->compound != NULL || command->argc == 0) command = NULL;
+		else builtin = findBuiltin(command->argv[0]);
+	}
+
+	if (command != NULL && builtin != NULL && (builtin->flags & BUILTIN_INPROCESS)) {
+		int memory = memfd_create("substitution", MFD_CLOEXEC);
+		if (memory != -1) {
+			status = runBuiltinStage(builtin, command, -1, memory);
+			lseek(memory, 0, SEEK_SET);
+			size = captureOutput(memory, &output, &capacity);
+			close(memory);
+		}
+		else status = 1;
+	}
+	else if (root != NULL) {
+		struct spawnAttr attr;
+		int pipefd[2];
+		pid_t child;
+
+		if (pipe2(pipefd, O_CLOEXEC) == -1) {
+			perror("pipe");
+			status = 1;
+		}
+		else {
+			sizePipe(pipefd[1]);
+			initSpawnAttr(&attr);
+			attr.outFd = pipefd[1];
+			attr.pgid = GBSH_PGID;
+			if (command != NULL && builtin == NULL) {
+				attr.redirections = command->redirections;
+				attr.assignments = command->assignments;
+				child = spawnProcess(command->argv, &attr);
+			}
+			else if ((child = forkProcess(&attr)) == 0) {
+				GBSH_IS_INTERACTIVE = 0;
+				forgetJobs();
+				close(pipefd[0]);
+				status = executeNode(root);
+				fflush(stdout);
+				_exit(status);
+			}
+			close(pipefd[1]);
+			size = captureOutput(pipefd[0], &output, &capacity);
+			close(pipefd[0]);
+
+			if (child == -1) status = spawnFailureStatus(errno);
+			else {
+				while (waitpid(child, &status, 0) == -1 && errno == EINTR);
+				status = exitStatus(status);
+			}
+		}
+	}
+
+	free(expansionBuffer);
+	expansionBuffer = outerBuffer;
+	expansionLength = outerLength;
+	expansionCapacity = outerCapacity;
+	lineExpansions = outerExpansions;
+	substitutionStatus = lastStatus = status;
+
+	while (size > 0 && output[size - 1] == '\n') size--;
+	line = arenaAlloc(&lineArena, size + 1);
+	if (size > 0) memcpy(line, output, size);
+	line[size] = '\0';
+	free(output);
+	return line;
+}
+
+/**
+* Method used to add a word to a list of the line arena, doubling it when
+* it is full. The list always ends with NULL.
+*/
+void appendWord(struct wordList* list, char* word) {
+	if (list->count + 1 >= list->capacity) {
+		char** grown;
+		list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+		grown = arenaAlloc(&lineArena, list->capacity * sizeof(char*));
+		if (list->count > 0) memcpy(grown, list->words, list->count * sizeof(char*));
+		list->words = grown;
+	}
+	list->words[list->count++] = word;
+	list->words[list->count] = NULL;
+}
+
+/**
+* Method used to append length bytes to the expansion buffer. The buffer is
+* kept between the lines, so it only grows until it holds the longest word.
+*/
+void expansionAppend(const char* text, size_t length) {
+	if (expansionLength + length + 1 > expansionCapacity) {
+		size_t grown = expansionCapacity == 0 ? 256 : expansionCapacity;
+		while (grown < expansionLength + length + 1) grown *= 2;
+		expansionBuffer = realloc(expansionBuffer, grown);
+		expansionCapacity = grown;
+	}
+	memcpy(expansionBuffer + expansionLength, text, length);
+	expansionLength += length;
+}
+
+/**
+* Method used to copy the field being built to the line arena and add it
+* to the list. A field with a pattern is replaced by the paths it matches
+* when split is set, the words that are never split keep it as text.
+*/
+void endField(struct wordList* list, size_t start, int split) {
+	char* field = arenaAlloc(&lineArena, expansionLength - start + 1);
+
+	memcpy(field, expansionBuffer + start, expansionLength - start);
+	field[expansionLength - start] = '\0';
+	if (strpbrk(field, GLOB_MARKERS) == NULL) appendWord(list, field);
+	else if (split) globWord(field, list);
+	else appendWord(list, restoreGlob(field));
+}
+
+/**
+* Method used to expand a word in a single pass, adding its fields to the
+* list. The value of an expansion that was not quoted is split on spaces,
+* tabs and newlines when split is set; a word that expands to nothing then
+* disappears. Without split the word is always one field.
+*/
+void expandWord(char* word, int split, struct wordList* list) {
+	const char* src = word;
+	size_t start;
+	int started = 0;
+
+	// Most words have nothing to expand and are used as they are
+	if (strpbrk(word, WORD_MARKERS) == NULL) {
+		appendWord(list, word);
+		return;
+	}
+
+	expansionLength = 0;
+	start = 0;
+	while (*src != '\0') {
+		const char* plain = src;
+		const char* value;
+
+		while (!(charClass[(unsigned char)*src] & (CHAR_MARKER | CHAR_END))) src++;
+		if (src > plain) {
+			expansionAppend(plain, src - plain);
+			started = 1;
+		}
+		if (*src == '\0') break;
+
+		int quoted = *src == EXPAND_QUOTED_MARKER || *src == SUBSTITUTION_QUOTED_MARKER;
+		if (*src == SUBSTITUTION_MARKER || *src == SUBSTITUTION_QUOTED_MARKER) {
+			const char* end = strchr(src, SUBSTITUTION_END);
+			value = substituteCommand(src + 1, end - src - 1);
+			src = end + 1;
+		}
+		else src = expandVariable(src + 1, &value);
+		if (quoted) started = 1;
+		if (value == NULL) continue;
+		if (quoted || !split) {
+			expansionAppend(value, strlen(value));
+			started = 1;
+			continue;
+		}
+		// Each space ends the field it follows
+		while (*value != '\0') {
+			size_t length = strcspn(value, " \t\n");
+			if (length > 0) {
+				expansionAppend(value, length);
+				started = 1;
+				value += length;
+			}
+			if (*value == '\0') break;
+			value += strspn(value, " \t\n");
+			if (started) {
+				endField(list, start, split);
+				start = expansionLength;
+				started = 0;
+			}
+		}
+	}
+	if (started || !split) endField(list, start, split);
+}
+
+/**
+* Method used to expand a word that is never split: an assignment or the
+* file of a redirection
+*/
+char* expandString(char* word) {
+	struct wordList list = { NULL, 0, 0 };
+
+	expandWord(word, 0, &list);
+	return list.words[0];
+}
+
+/**
+* Method used to expand the words of a pipeline right before it runs, so
+* they see the variables and the status of the commands that ran before it
+* in the same line. The expanded pipeline is built in the arena and shares
+* what did not change. A line without any '$' or pattern runs its tree as
+* it is.
+*/
+struct pipeline* expandPipeline(struct pipeline* pipeline) {
+	struct pipeline* expanded;
+	struct redirection* redirection;
+	struct redirection** last;
+	int i, j;
+
+	substitutionStatus = 0;
+	if (lineExpansions == 0) return pipeline;
+
+	expanded = arenaAlloc(&lineArena, sizeof(struct pipeline));
+	*expanded = *pipeline;
+	expanded->stages = arenaAlloc(&lineArena, pipeline->count * sizeof(struct command));
+	for (i = 0; i < pipeline->count; i++) {
+		struct command* stage = &expanded->stages[i];
+		struct wordList list = { NULL, 0, 0 };
+
+		*stage = pipeline->stages[i];
+		if (stage->argc > 0) {
+			for (j = 0; j < stage->argc; j++) expandWord(pipeline->stages[i].argv[j], 1, &list);
+			if (list.count == 0) {
+				list.words = arenaAlloc(&lineArena, sizeof(char*));
+				list.words[0] = NULL;
+			}
+			stage->argv = list.words;
+			stage->argc = list.count;
+		}
+		if (stage->assignmentCount > 0) {
+			stage->assignments = arenaAlloc(&lineArena, (stage->assignmentCount + 1) * sizeof(char*));
+			for (j = 0; j <= stage->assignmentCount; j++)
+				stage->assignments[j] = j < stage->assignmentCount ? expandString(pipeline->stages[i].assignments[j]) : NULL;
+		}
+		last = &stage->redirections;
+		for (redirection = pipeline->stages[i].redirections; redirection != NULL; redirection = redirection->next) {
+			*last = arenaAlloc(&lineArena, sizeof(struct redirection));
+			**last = *redirection;
+			(*last)->file = expandString(redirection->file);
+			last = &(*last)->next;
+		}
+	}
+	return expanded;
+}
+
+/**
+ * GLOB
+ */
+
+/**
+* Method used to write the pattern markers of a text back as the characters
+* that were typed. The text is changed in place.
+*/
+char* restoreGlob(char* text) {
+	for (char* c = text; *c != '\0'; c++) {
+		if (*c == GLOB_STAR) *c = '*';
+		else if (*c == GLOB_ANY) *c = '?';
+		else if (*c == GLOB_SET) *c = '[';
+	}
+	return text;
+}
+
+/**
+* Method used to compile the class that follows a '[' into the bitmap of
+* the bytes it matches: single characters, ranges like a-z, classes like
+* [:digit:], and all the others when it starts with '!' or '^'. A ']'
+* right after the '[' is a character. It returns how many characters the
+* class takes with its ']', or 0 when it is not closed and the '[' is a
+* character.
+*/
+size_t compileClass(const char* text, size_t length, unsigned char* set) {
+	static const struct {
+		const char* name;
+		int (*test)(int c);
+	} classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "digit", isdigit },
+		{ "lower", islower }, { "punct", ispunct }, { "space", isspace }, { "upper", isupper },
+		{ "xdigit", isxdigit },
+	};
+	size_t i = 0;
+	int negate = 0;
+
+	memset(set, 0, 32);
+	if (i < length && (text[i] == '!' || text[i] == '^')) {
+		negate = 1;
+		i++;
+	}
+	for (size_t first = i; i < length && (text[i] != ']' || i == first);) {
+		unsigned char low = text[i] == GLOB_STAR ? '*' : text[i] == GLOB_ANY ? '?' : text[i] == GLOB_SET ? '[' : text[i];
+		const char* close;
+
+		if (low == '[' && i + 1 < length && text[i + 1] == ':' &&
+			(close = memmem(text + i + 2, length - i - 2, ":]", 2)) != NULL) {
+			size_t nameLength = close - (text + i + 2);
+			for (size_t k = 0; k < sizeof(classes) / sizeof(classes[0]); k++) {
+				if (strlen(classes[k].name) != nameLength || strncmp(classes[k].name, text + i + 2, nameLength) != 0) continue;
+				for (int c = 1; c < 256; c++)
+					if (classes[k].test(c)) set[c >> 3] |= 1 << (c & 7);
+			}
+			i = close + 2 - text;
+		}
+		else if (i + 2 < length && text[i + 1] == '-' && text[i + 2] != ']') {
+			for (int c = low; c <= (unsigned char)text[i + 2]; c++) set[c >> 3] |= 1 << (c & 7);
+			i += 3;
+		}
+		else {
+			set[low >> 3] |= 1 << (low & 7);
+			i++;
+		}
+	}
+	if (i >= length) return 0;
+	if (negate)
+		for (int c = 0; c < 32; c++) set[c] = ~set[c];
+	return i + 1;
+}
+
+/**
+* Method used to compile a component of a pattern into its steps, in the
+* line arena. A run of '*' is one step, and the literal after the last '*'
+* is kept as a suffix the names are checked against first. It returns 1
+* when the component has a pattern, and 0 when it is a plain name.
+*/
+int compileComponent(const char* text, size_t length, struct globComponent* component) {
+	char* literal = arenaAlloc(&lineArena, length + 1);
+	size_t literalLength = 0;
+	int pattern = 0;
+	int anything = 0;
+
+	memset(component, 0, sizeof(struct globComponent));
+	if (length == 2 && text[0] == GLOB_STAR && text[1] == GLOB_STAR) {
+		component->recursive = 1;
+		return 1;
+	}
+	component->steps = arenaAlloc(&lineArena, (length + 1) * sizeof(struct globStep));
+	for (size_t i = 0; i < length;) {
+		struct globStep* step = &component->steps[component->count];
+		size_t classLength;
+
+		if (text[i] == GLOB_STAR) {
+			if (component->count == 0 || step[-1].type != GLOB_ANYTHING) {
+				step->type = GLOB_ANYTHING;
+				component->count++;
+			}
+			anything = pattern = 1;
+			i++;
+			continue;
+		}
+		if (text[i] == GLOB_ANY) {
+			step->type = GLOB_ONE;
+			component->count++;
+			component->minimum++;
+			pattern = 1;
+			i++;
+			continue;
+		}
+		if (text[i] == GLOB_SET) {
+			unsigned char* set = arenaAlloc(&lineArena, 32);
+			if ((classLength = compileClass(text + i + 1, length - i - 1, set)) > 0) {
+				step->type = GLOB_CLASS;
+				step->set = set;
+				component->count++;
+				component->minimum++;
+				pattern = 1;
+				i += classLength + 1;
+				continue;
+			}
+		}
+		// The characters of the name join the literal step before them
+		if (component->count == 0 || step[-1].type != GLOB_LITERAL) {
+			step->type = GLOB_LITERAL;
+			step->text = literal + literalLength;
+			step->length = 0;
+			component->count++;
+			step++;
+		}
+		literal[literalLength++] = text[i] == GLOB_SET ? '[' : text[i];
+		step[-1].length++;
+		component->minimum++;
+		i++;
+	}
+	literal[literalLength] = '\0';
+
+	if (!pattern) component->name = literal;
+	component->hidden = literal[0] == '.' && component->count > 0 && component->steps[0].type == GLOB_LITERAL;
+	if (anything && component->steps[component->count - 1].type == GLOB_LITERAL) {
+		component->suffix = component->steps[component->count - 1].text;
+		component->suffixLength = component->steps[component->count - 1].length;
+	}
+	return pattern;
+}
+
+/**
+* Method used to match a name with the steps of a component. A step that
+* does not match goes back to the last '*', which takes one more character,
+* so no name is read more than once per '*'.
+*/
+int globMatch(const struct globComponent* component, const char* name, size_t length) {
+	size_t position = 0;
+	size_t starPosition = 0;
+	int star = -1;
+	int i = 0;
+
+	if (length < component->minimum) return 0;
+	if (component->suffixLength > 0 && memcmp(name + length - component->suffixLength, component->suffix, component->suffixLength) != 0)
+		return 0;
+	while (TRUE) {
+		if (i < component->count) {
+			const struct globStep* step = &component->steps[i];
+			unsigned char c = name[position];
+
+			if (step->type == GLOB_ANYTHING) {
+				star = i++;
+				starPosition = position;
+				continue;
+			}
+			if (position < length) {
+				if (step->type == GLOB_LITERAL && length - position >= step->length &&
+					memcmp(name + position, step->text, step->length) == 0) {
+					position += step->length;
+					i++;
+					continue;
+				}
+				// A '?' takes a whole UTF-8 character
+				if (step->type == GLOB_ONE) {
+					while (++position < length && ((unsigned char)name[position] & 0xc0) == 0x80);
+					i++;
+					continue;
+				}
+				// The byte a character starts with picks it out of a class
+				if (step->type == GLOB_CLASS && (step->set[c >> 3] & (1 << (c & 7)))) {
+					while (++position < length && ((unsigned char)name[position] & 0xc0) == 0x80);
+					i++;
+					continue;
+				}
+			}
+		}
+		else if (position == length) return 1;
+
+		if (star == -1 || starPosition == length) return 0;
+		while (++starPosition < length && ((unsigned char)name[starPosition] & 0xc0) == 0x80);
+		position = starPosition;
+		i = star + 1;
+	}
+}
+
+/**
+* Method used to add a name to the path being matched, after a '/'. It
+* returns the new length of the path.
+*/
+size_t appendPath(size_t pathLength, const char* name, size_t length) {
+	if (growLine(&globPath, &globPathCapacity, pathLength + length + 2) == -1) return pathLength;
+	if (pathLength > 0 && globPath[pathLength - 1] != '/') globPath[pathLength++] = '/';
+	memcpy(globPath + pathLength, name, length);
+	globPath[pathLength + length] = '\0';
+	return pathLength + length;
+}
+
+/**
+* Method used to know if an entry is a directory without a stat, from the
+* type getdents64 gives; only file systems that give no type need one.
+* Links are not followed, so "**" never loops.
+*/
+int entryIsDirectory(int fd, struct linuxDirent64* entry) {
+	struct stat sb;
+
+	if (entry->d_type != DT_UNKNOWN) return entry->d_type == DT_DIR;
+	return fstatat(fd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode);
+}
+
+/**
+* Method used to match the components from index on in the directory of
+* the path. The directory is read once with large getdents64 batches: the
+* names the last component matches are added as they are read, and the
+* directories the other components match are kept and gone into after the
+* directory is closed. A plain name is not looked for in its directory, a
+* stat tells if it is there only when it is the last component.
+*/
+void globComponents(struct globComponent* components, int index, int count, size_t pathLength, struct wordList* list) {
+	struct globComponent* component = &components[index];
+	int last = index == count - 1;
+	struct wordList directories = { NULL, 0, 0 };
+	long n;
+	int fd;
+
+	if (component->name != NULL) {
+		struct stat sb;
+		size_t length = appendPath(pathLength, component->name, strlen(component->name));
+
+		if (!last) globComponents(components, index + 1, count, length, list);
+		else if (fstatat(AT_FDCWD, globPath, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+			appendWord(list, arenaStrdup(&lineArena, globPath));
+		return;
+	}
+	// "**" also matches no directory at all
+	if (component->recursive) globComponents(components, index + 1, count, pathLength, list);
+
+	if (globBuffer == NULL && (globBuffer = malloc(GLOB_SCAN_SIZE)) == NULL) return;
+	if (pathLength > 0) globPath[pathLength] = '\0';
+	if ((fd = open(pathLength == 0 ? "." : globPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) return;
+	while ((n = syscall(SYS_getdents64, fd, globBuffer, GLOB_SCAN_SIZE)) > 0) {
+		for (long offset = 0; offset < n;) {
+			struct linuxDirent64* entry = (struct linuxDirent64*)(globBuffer + offset);
+			const char* name = entry->d_name;
+			size_t length;
+
+			offset += entry->d_reclen;
+			// Hidden names only match a pattern that starts with a '.'
+			if (name[0] == '.' && (!component->hidden || name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+				continue;
+			length = strlen(name);
+			if (component->recursive ? !entryIsDirectory(fd, entry) : !globMatch(component, name, length)) continue;
+
+			if (last && !component->recursive) {
+				appendPath(pathLength, name, length);
+				appendWord(list, arenaStrdup(&lineArena, globPath));
+			}
+			// The next component can only be in a directory, or a link to one
+			else if (component->recursive || entry->d_type == DT_DIR || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+				appendWord(&directories, arenaStrdup(&lineArena, name));
+		}
+	}
+	close(fd);
+
+	for (int i = 0; i < directories.count; i++) {
+		size_t length = appendPath(pathLength, directories.words[i], strlen(directories.words[i]));
+		globComponents(components, component->recursive ? index : index + 1, count, length, list);
+	}
+}
+
+/**
+* Method used to replace a word with a pattern by the paths it matches,
+* sorted once they are all found unless the globsort option is off. The
+* pattern is compiled once, a component at a time. A word that matches
+* nothing is kept as it was written.
+*/
+void globWord(char* word, struct wordList* list) {
+	struct globComponent* components;
+	const char* component = word;
+	size_t pathLength = 0;
+	int first = list->count;
+	int count = 2;
+	int pattern = 0;
+
+	for (const char* c = word; *c != '\0'; c++)
+		if (*c == '/') count++;
+	components = arenaAlloc(&lineArena, count * sizeof(struct globComponent));
+	count = 0;
+	if (*word == '/') {
+		pathLength = appendPath(0, "/", 1);
+		while (*component == '/') component++;
+	}
+	while (TRUE) {
+		const char* end = strchrnul(component, '/');
+
+		pattern |= compileComponent(component, end - component, &components[count++]);
+		if (*end == '\0') break;
+		component = end + 1;
+	}
+	// A "**" at the end matches everything under the directory, like "**/*"
+	if (components[count - 1].recursive) compileComponent((char[]){ GLOB_STAR }, 1, &components[count++]);
+
+	if (pattern) globComponents(components, 0, count, pathLength, list);
+	if (list->count == first) appendWord(list, restoreGlob(word));
+	else if (optionGlobSort) qsort(list->words + first, list->count - first, sizeof(char*), compareEntries);
+}
+
+/**
+ * TRACE
+ */
+
+/**
+* Method used to start writing the trace to a file. It is opened to append
+* and without blocking, so a slow reader of a fifo never stops the shell.
+*/
+int openTrace(const char* path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC, 0600);
+
+	if (fd == -1) {
+		fprintf(stderr, "trace: %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	closeTrace();
+	trace.fd = fd;
+	trace.path = strdup(path);
+	if (!trace.registered) {
+		atexit(closeTrace);
+		trace.registered = 1;
+	}
+	return 0;
+}
+
+/**
+* Method used to stop the trace, writing what is still in the buffer. The
+* forked children do not write the records of their parent.
+*/
+void closeTrace(void) {
+	if (trace.fd == -1 || getpid() != GBSH_PID) return;
+	flushTrace();
+	close(trace.fd);
+	free(trace.path);
+	trace.fd = -1;
+	trace.path = NULL;
+	trace.length = 0;
+}
+
+/**
+* Method used to write the buffered records. What the file does not take
+* now stays in the buffer for the next time.
+*/
+void flushTrace(void) {
+	size_t written = 0;
+	ssize_t n;
+
+	while (written < trace.length) {
+		n = write(trace.fd, trace.buffer + written, trace.length - written);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		written += n;
+	}
+	memmove(trace.buffer, trace.buffer + written, trace.length - written);
+	trace.length -= written;
+}
+
+/**
+* Method used to start a record. Every record begins with when it was
+* written, the line it belongs to and the shell that wrote it.
+*/
+void beginTrace(const char* type) {
+	struct timespec now;
+
+	if (trace.length > TRACE_BUFFER_SIZE / 2) flushTrace();
+	trace.recordStart = trace.length;
+	trace.overflow = 0;
+	clock_gettime(CLOCK_REALTIME, &now);
+	tracePrintf("{\"ts\":%ld.%06ld,\"line\":%ld,\"pid\":%d,\"node\":\"%s\"", (long)now.tv_sec, now.tv_nsec / 1000,
+		trace.lines, (int)getpid(), type);
+}
+
+/**
+* Method used to end a record. A record that did not fit in the buffer is
+* dropped whole and counted.
+*/
+void endTrace(void) {
+	tracePrintf("}\n");
+	if (trace.overflow) {
+		trace.length = trace.recordStart;
+		trace.dropped++;
+		return;
+	}
+	trace.records++;
+	if (trace.length > TRACE_BUFFER_SIZE * 3 / 4) flushTrace();
+}
+
+/**
+* Method used to add formatted text to the record being written
+*/
+void tracePrintf(const char* format, ...) {
+	size_t room = TRACE_BUFFER_SIZE - trace.length;
+	va_list arguments;
+	int n;
+
+	if (trace.overflow) return;
+	va_start(arguments, format);
+	n = vsnprintf(trace.buffer + trace.length, room, format, arguments);
+	va_end(arguments);
+	if (n < 0 || (size_t)n >= room) trace.overflow = 1;
+	else trace.length += n;
+}
+
+/**
+* Method used to add a JSON string to the record. Long strings are cut at
+* TRACE_STRING_MAX bytes.
+*/
+void traceString(const char* string) {
+	size_t i;
+
+	if (trace.overflow || TRACE_BUFFER_SIZE - trace.length < TRACE_STRING_MAX * 6 + 8) {
+		trace.overflow = 1;
+		return;
+	}
+	trace.buffer[trace.length++] = '"';
+	for (i = 0; string[i] != '\0' && i < TRACE_STRING_MAX; i++) {
+		unsigned char c = string[i];
+		if (c == '"' || c == '\\') {
+			trace.buffer[trace.length++] = '\\';
+			trace.buffer[trace.length++] = c;
+		}
+		else if (c < 0x20) trace.length += sprintf(trace.buffer + trace.length, "\\u%04x", c);
+		else trace.buffer[trace.length++] = c;
+	}
+	if (string[i] != '\0') {
+		memcpy(trace.buffer + trace.length, "...", 3);
+		trace.length += 3;
+	}
+	trace.buffer[trace.length++] = '"';
+}
+
+/**
+* Method used to write the record of a pipeline: its stages with their
+* arguments, redirections, spawn latency, wall time, status and usage
+*/
+void tracePipeline(struct pipeline* pipeline, struct stageTime times[], int statuses[], struct timespec* start) {
+	struct timespec end;
+	int i, j;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	beginTrace("pipeline");
+	tracePrintf(",\"id\":%ld,\"background\":%s,\"status\":%d,\"wall_us\":%.1f,\"stages\":[", ++trace.pipelines,
+		pipeline->background ? "true" : "false", pipeline->background ? 0 : pipelineStatus(statuses, pipeline->count),
+		elapsedSeconds(start, &end) * 1e6);
+
+	for (i = 0; i < pipeline->count; i++) {
+		struct command* stage = &pipeline->stages[i];
+		struct rusage* usage = &times[i].usage;
+
+		tracePrintf("%s{\"argv\":[", i > 0 ? "," : "");
+		if (stage->compound != NULL) traceString("if");
+		for (j = 0; j < stage->argc; j++) {
+			if (j > 0 || stage->compound != NULL) tracePrintf(",");
+			traceString(stage->argv[j]);
+		}
+		tracePrintf("],\"redirections\":[");
+		for (struct redirection* redirection = stage->redirections; redirection != NULL; redirection = redirection->next) {
+			tracePrintf("%s{\"op\":\"%s\",\"file\":", redirection != stage->redirections ? "," : "",
+				redirection->type == REDIRECT_INPUT ? "<" : redirection->type == REDIRECT_APPEND ? ">>" : ">");
+			traceString(redirection->file);
+			tracePrintf("}");
+		}
+		tracePrintf("],\"pid\":%d,\"spawn_us\":%.1f", (int)times[i].pid, times[i].spawnMicros);
+		if (!pipeline->background) {
+			tracePrintf(",\"wall_us\":%.1f,\"status\":%d,\"user_us\":%ld,\"sys_us\":%ld,\"maxrss_kb\":%ld,"
+				"\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld",
+				elapsedSeconds(&times[i].start, &times[i].end) * 1e6, statuses[i],
+				usage->ru_utime.tv_sec * 1000000L + usage->ru_utime.tv_usec,
+				usage->ru_stime.tv_sec * 1000000L + usage->ru_stime.tv_usec,
+				usage->ru_maxrss, usage->ru_minflt, usage->ru_majflt, usage->ru_nvcsw, usage->ru_nivcsw);
+		}
+		tracePrintf("}");
+	}
+	tracePrintf("]");
+	if (trace.dropped > 0) tracePrintf(",\"dropped\":%ld", trace.dropped);
+	endTrace();
+}
+
+/**
+* Method used to write the record of a node that joins other nodes
+*/
+void traceNode(struct node* node, int status, struct timespec* start) {
+	static const char* names[] = { "pipeline", "sequence", "and", "or", "if", "background" };
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	beginTrace(names[node->type]);
+	tracePrintf(",\"status\":%d,\"wall_us\":%.1f", status, elapsedSeconds(start, &end) * 1e6);
+	endTrace();
+}
+
+/**
+* Builtin trace: 'trace FILE' writes a JSON line for every command that
+* runs to FILE, 'trace off' stops it and 'trace' alone tells where it goes
+*/
+int traceCommand(char* args[]) {
+	if (args[1] == NULL) {
+		if (trace.fd == -1) printf("trace: off\n");
+		else printf("trace: %s, %ld records, %ld dropped\n", trace.path, trace.records, trace.dropped);
+		return 0;
+	}
+	if (strcmp(args[1], "off") == 0) {
+		closeTrace();
+		return 0;
+	}
+	return openTrace(args[1]) == -1 ? 1 : 0;
+}
+
+/**
+ * LINE READER
+ */
+
+/**
+* Method used to put the terminal in the mode of the line reader, where the
+* keys are read one by one and not echoed, or back in the saved mode
+*/
+void rawMode(int enable) {
+	struct termios modes = GBSH_TMODES;
+
+	if (enable) {
+		modes.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+		modes.c_cc[VMIN] = 1;
+		modes.c_cc[VTIME] = 0;
+	}
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &modes);
+}
+
+/**
+* Method used to make room for length bytes in the line
+*/
+int growLine(char** line, size_t* capacity, size_t length) {
+	size_t grown = *capacity == 0 ? 128 : *capacity;
+	char* buffer;
+
+	if (length <= *capacity) return 0;
+	while (grown < length) grown *= 2;
+	if ((buffer = realloc(*line, grown)) == NULL) return -1;
+	*line = buffer;
+	*capacity = grown;
+	return 0;
+}
+
+/**
+* Method used to read one key. It returns -1 at the end of the input and
+* when Ctrl+C interrupts the read; other signals are ignored.
+*/
+int readKey(void) {
+	unsigned char c;
+	ssize_t n;
+
+	while ((n = read(STDIN_FILENO, &c, 1)) == -1 && errno == EINTR && !lineInterrupted);
+	return n == 1 ? c : -1;
+}
+
+/**
+* Method used to know if more keys are already waiting, as when a line is
+* pasted, so the line is drawn once after the last of them
+*/
+int keyPending(void) {
+	int pending = 0;
+
+	return ioctl(STDIN_FILENO, FIONREAD, &pending) == 0 && pending > 0;
+}
+
+/**
+* Method used to read the rest of an escape sequence and tell which key
+* sent it; Alt+KEY sends the escape and then the key. It returns 0 for the
+* keys the editor does not handle.
+*/
+int readEscape(void) {
+	int parameters[2] = { 0, 0 };
+	int count = 0;
+	int c = readKey();
+
+	switch (c) {
+	case 'b':
+		return KEY_WORD_LEFT;
+	case 'f':
+		return KEY_WORD_RIGHT;
+	case 'd':
+		return KEY_WORD_DELETE;
+	case 127:
+	case CTRL('H'):
+		return KEY_WORD_RUBOUT;
+	case '[':
+	case 'O':
+		break;
+	default:
+		return 0;
+	}
+	// The sequence has numbers split by ';' before its final byte
+	while ((c = readKey()) != -1 && !(c >= 0x40 && c <= 0x7e)) {
+		if (c == ';') count++;
+		else if (c >= '0' && c <= '9' && count < 2) parameters[count] = parameters[count] * 10 + c - '0';
+	}
+	// Alt and Ctrl with an arrow move by words
+	if ((c == 'C' || c == 'D') && (parameters[1] == 3 || parameters[1] == 5))
+		return c == 'C' ? KEY_WORD_RIGHT : KEY_WORD_LEFT;
+	switch (c) {
+	case 'A':
+		return KEY_UP;
+	case 'B':
+		return KEY_DOWN;
+	case 'C':
+		return KEY_RIGHT;
+	case 'D':
+		return KEY_LEFT;
+	case 'H':
+		return KEY_HOME;
+	case 'F':
+		return KEY_END;
+	case '~':
+		if (parameters[0] == 1 || parameters[0] == 7) return KEY_HOME;
+		if (parameters[0] == 4 || parameters[0] == 8) return KEY_END;
+		if (parameters[0] == 3) return KEY_DELETE;
+	}
+	return 0;
+}
+
+/**
+* Method used to count the columns text takes on the terminal, one for
+* every UTF-8 character, so the bytes that go on a character do not count
+*/
+int textColumns(const char* text, size_t length) {
+	int columns = 0;
+
+	for (size_t i = 0; i < length; i++)
+		if (((unsigned char)text[i] & 0xc0) != 0x80) columns++;
+	return columns;
+}
+
+/**
+* Method used to get the width of the terminal
+*/
+int terminalColumns(void) {
+	struct winsize size;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1 || size.ws_col == 0) return 80;
+	return size.ws_col;
+}
+
+/**
+* Method used to add text to what the key writes
+*/
+void editorWrite(const char* text, size_t length) {
+	if (growLine(&editor.output, &editor.outputCapacity, editor.outputLength + length) == -1) return;
+	memcpy(editor.output + editor.outputLength, text, length);
+	editor.outputLength += length;
+}
+
+/**
+* Method used to move the cursor from a column to another one of the line
+*/
+void editorMove(int from, int to) {
+	char sequence[16];
+	int length;
+
+	if (from == to) return;
+	length = snprintf(sequence, sizeof(sequence), "\033[%d%c", from > to ? from - to : to - from, from > to ? 'D' : 'C');
+	editorWrite(sequence, length);
+}
+
+/**
+* Method used to send what the key wrote to the terminal, in one write
+*/
+void editorFlush(void) {
+	if (editor.outputLength > 0) writeAll(STDOUT_FILENO, editor.output, editor.outputLength);
+	editor.outputLength = 0;
+}
+
+/**
+* Method used to draw the line after the prompt. The visible part of the
+* line is compared with what the terminal shows: the cursor goes to the
+* first character that changed and only the rest is written, and the end
+* is cleared only when the line got shorter. With full, the prompt and the
+* line are drawn again from the start of the row.
+*/
+void refreshLine(int full) {
+	const char* visible;
+	size_t visibleLength = 0;
+	size_t common;
+	int width, commonColumn, cursorColumn, endColumn, shownColumns;
+
+	if (windowResized) {
+		windowResized = 0;
+		editor.columns = terminalColumns();
+		full = 1;
+	}
+	if (full) {
+		editorWrite("\r", 1);
+		if (prompt.text != NULL) editorWrite(prompt.text, prompt.length);
+		editorWrite("\033[K", 3);
+		editor.shownLength = 0;
+		editor.shownCursor = 0;
+	}
+
+	// A line wider than the terminal scrolls to keep the cursor in sight.
+	// The last column is left for the cursor, so the terminal never wraps.
+	width = editor.columns - prompt.columns - 1;
+	if (width < 1) width = 1;
+	if (editor.cursor < editor.offset) editor.offset = editor.cursor;
+	while (textColumns(*editor.line + editor.offset, editor.cursor - editor.offset) > width)
+		editor.offset = nextCharacter(editor.offset);
+	while (editor.offset > 0 && textColumns(*editor.line + previousCharacter(editor.offset),
+		editor.length - previousCharacter(editor.offset)) <= width)
+		editor.offset = previousCharacter(editor.offset);
+	visible = *editor.line + editor.offset;
+	for (int used = 0; editor.offset + visibleLength < editor.length && used < width; used++)
+		visibleLength = nextCharacter(editor.offset + visibleLength) - editor.offset;
+
+	for (common = 0; common < visibleLength && common < editor.shownLength && visible[common] == editor.shown[common]; common++);
+	while (common > 0 && common < visibleLength && ((unsigned char)visible[common] & 0xc0) == 0x80) common--;
+	commonColumn = textColumns(visible, common);
+	cursorColumn = textColumns(visible, editor.cursor - editor.offset);
+	endColumn = textColumns(visible, visibleLength);
+	shownColumns = textColumns(editor.shown, editor.shownLength);
+
+	if (common < visibleLength || common < editor.shownLength) {
+		editorMove(editor.shownCursor, commonColumn);
+		editorWrite(visible + common, visibleLength - common);
+		if (shownColumns > endColumn) editorWrite("\033[K", 3);
+		editorMove(endColumn, cursorColumn);
+	}
+	else editorMove(editor.shownCursor, cursorColumn);
+
+	if (growLine(&editor.shown, &editor.shownCapacity, visibleLength + 1) == 0) {
+		memcpy(editor.shown, visible, visibleLength);
+		editor.shownLength = visibleLength;
+	}
+	editor.shownCursor = cursorColumn;
+}
+
+/**
+* Method used to find where the character before position starts
+*/
+size_t previousCharacter(size_t position) {
+	const char* line = *editor.line;
+
+	if (position == 0) return 0;
+	while (--position > 0 && ((unsigned char)line[position] & 0xc0) == 0x80);
+	return position;
+}
+
+/**
+* Method used to find where the character after position starts
+*/
+size_t nextCharacter(size_t position) {
+	const char* line = *editor.line;
+
+	if (position >= editor.length) return editor.length;
+	while (++position < editor.length && ((unsigned char)line[position] & 0xc0) == 0x80);
+	return position;
+}
+
+/**
+* Method used to know if a byte is part of a word for Alt+B, Alt+F and Alt+D
+*/
+int wordCharacter(unsigned char c) {
+	return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+/**
+* Method used to find the start of the word before position
+*/
+size_t previousWord(size_t position) {
+	const unsigned char* line = (const unsigned char*)*editor.line;
+
+	while (position > 0 && !wordCharacter(line[position - 1])) position--;
+	while (position > 0 && wordCharacter(line[position - 1])) position--;
+	return position;
+}
+
+/**
+* Method used to find the end of the word after position
+*/
+size_t nextWord(size_t position) {
+	const unsigned char* line = (const unsigned char*)*editor.line;
+
+	while (position < editor.length && !wordCharacter(line[position])) position++;
+	while (position < editor.length && wordCharacter(line[position])) position++;
+	return position;
+}
+
+/**
+* Method used to insert text at the cursor
+*/
+void insertText(const char* text, size_t length) {
+	char* line;
+
+	// The line keeps room for the line break readLine adds
+	if (length == 0 || growLine(editor.line, editor.capacity, editor.length + length + 2) == -1) return;
+	line = *editor.line;
+	memmove(line + editor.cursor + length, line + editor.cursor, editor.length - editor.cursor);
+	memcpy(line + editor.cursor, text, length);
+	editor.length += length;
+	editor.cursor += length;
+}
+
+/**
+* Method used to remove the text from start to end, and to keep it for
+* Ctrl+Y when save is set
+*/
+void killText(size_t start, size_t end, int save) {
+	char* line = *editor.line;
+
+	if (start >= end) return;
+	if (save && growLine(&editor.killed, &editor.killedCapacity, end - start) == 0) {
+		memcpy(editor.killed, line + start, end - start);
+		editor.killedLength = end - start;
+	}
+	memmove(line + start, line + end, editor.length - end);
+	editor.length -= end - start;
+	if (editor.cursor >= end) editor.cursor -= end - start;
+	else if (editor.cursor > start) editor.cursor = start;
+}
+
+/**
+* Method used to replace the line with text, with the cursor at its end
+*/
+void setLine(const char* text, size_t length) {
+	if (growLine(editor.line, editor.capacity, length + 2) == -1) return;
+	memmove(*editor.line, text, length);
+	editor.length = length;
+	editor.cursor = length;
+}
+
+/**
+* Method used to show the entry position of the history in the line, for
+* Up and Down. The line being written is kept as the draft, which comes
+* after the last entry.
+*/
+void recallLine(int position) {
+	const char* entry;
+
+	if (position < 1 || position > history.count + 1 || position == editor.historyPosition) return;
+	if (editor.historyPosition == history.count + 1) {
+		free(editor.draft);
+		editor.draft = strndup(*editor.line, editor.length);
+	}
+	if (position == history.count + 1) entry = editor.draft != NULL ? editor.draft : "";
+	else if ((entry = recallHistory(position)) == NULL) return;
+	setLine(entry, strlen(entry));
+	editor.historyPosition = position;
+}
+
+/**
+* Method used to apply a key to the line, with the bindings of emacs. It
+* returns 1 when the whole line has to be drawn again.
+*/
+int editKey(int key) {
+	char* line = *editor.line;
+	size_t start, end;
+	char saved[4];
+
+	switch (key) {
+	case CTRL('A'):
+	case KEY_HOME:
+		editor.cursor = 0;
+		break;
+	case CTRL('E'):
+	case KEY_END:
+		editor.cursor = editor.length;
+		break;
+	case CTRL('B'):
+	case KEY_LEFT:
+		editor.cursor = previousCharacter(editor.cursor);
+		break;
+	case CTRL('F'):
+	case KEY_RIGHT:
+		editor.cursor = nextCharacter(editor.cursor);
+		break;
+	case KEY_WORD_LEFT:
+		editor.cursor = previousWord(editor.cursor);
+		break;
+	case KEY_WORD_RIGHT:
+		editor.cursor = nextWord(editor.cursor);
+		break;
+	case 127:
+	case CTRL('H'):
+		killText(previousCharacter(editor.cursor), editor.cursor, 0);
+		break;
+	case CTRL('D'):
+	case KEY_DELETE:
+		killText(editor.cursor, nextCharacter(editor.cursor), 0);
+		break;
+	case CTRL('K'):
+		killText(editor.cursor, editor.length, 1);
+		break;
+	case CTRL('U'):
+		killText(0, editor.cursor, 1);
+		break;
+	case CTRL('W'):
+		// Ctrl+W cuts back to the previous space, Alt+Backspace to the
+		// start of the word
+		for (start = editor.cursor; start > 0 && line[start - 1] == ' '; start--);
+		for (; start > 0 && line[start - 1] != ' '; start--);
+		killText(start, editor.cursor, 1);
+		break;
+	case KEY_WORD_RUBOUT:
+		killText(previousWord(editor.cursor), editor.cursor, 1);
+		break;
+	case KEY_WORD_DELETE:
+		killText(editor.cursor, nextWord(editor.cursor), 1);
+		break;
+	case CTRL('Y'):
+		insertText(editor.killed, editor.killedLength);
+		break;
+	case CTRL('T'):
+		// The character before the cursor goes after the one under it, at
+		// the end of the line the last two are swapped
+		if (editor.cursor == 0 || editor.length < 2) break;
+		if (editor.cursor == editor.length) editor.cursor = previousCharacter(editor.cursor);
+		start = previousCharacter(editor.cursor);
+		end = nextCharacter(editor.cursor);
+		if (editor.cursor - start > sizeof(saved)) break;
+		memcpy(saved, line + start, editor.cursor - start);
+		memmove(line + start, line + editor.cursor, end - editor.cursor);
+		memcpy(line + start + (end - editor.cursor), saved, editor.cursor - start);
+		editor.cursor = end;
+		break;
+	case CTRL('L'):
+		editorWrite("\033[H\033[2J", 7);
+		return 1;
+	case '\t':
+		return completeLine(editor.lastKey == '\t');
+	case CTRL('P'):
+	case KEY_UP:
+		recallLine(editor.historyPosition - 1);
+		break;
+	case CTRL('N'):
+	case KEY_DOWN:
+		recallLine(editor.historyPosition + 1);
+		break;
+	default:
+		if (key >= 32 && key < 256) {
+			char c = key;
+			insertText(&c, 1);
+		}
+	}
+	return 0;
+}
+
+/**
+* Method used for the incremental reverse search that Ctrl+R starts. Every
+* key refines the query and shows the most recent entry that contains it,
+* and Ctrl+R again goes to an older one. Enter runs the match, Ctrl+G gives
+* up and any other key leaves the match in the line to go on editing.
+* It returns the key that ended the search, or -1 when it was interrupted.
+*/
+int reverseSearch(char** line, size_t* capacity, size_t* length) {
+	char* query = NULL;
+	size_t queryCapacity = 0;
+	size_t queryLength = 0;
+	int match = 0;
+	int failed = 0;
+	int key;
+
+	if (growLine(&query, &queryCapacity, 1) == -1) return 0;
+	query[0] = '\0';
+
+	while (TRUE) {
+		const char* shown = match > 0 ? indexedEntry(match) : *line;
+		size_t shownLength = match > 0 ? strlen(shown) : *length;
+		const char* label = failed ? "\r\033[K(failed reverse-i-search)`" : "\r\033[K(reverse-i-search)`";
+		struct iovec parts[4] = {
+			{ (char*)label, strlen(label) },
+			{ query, queryLength },
+			{ "': ", 3 },
+			{ (char*)shown, shownLength },
+		};
+		writev(STDOUT_FILENO, parts, 4);
+
+		key = readKey();
+		if (key == CTRL('R')) {
+			int next = match;
+			// The same command is shown only once
+			do next = searchHistory(query, next > 0 ? next : historyIndex.count + 1);
+			while (next > 0 && match > 0 && strcmp(indexedEntry(next), indexedEntry(match)) == 0);
+			failed = next == 0;
+			if (next > 0) match = next;
+		}
+		else if (key == 127 || key == CTRL('H')) {
+			if (queryLength > 0) query[--queryLength] = '\0';
+			match = searchHistory(query, history.count + 1);
+			failed = queryLength > 0 && match == 0;
+		}
+		else if (key >= 32 && growLine(&query, &queryCapacity, queryLength + 2) == 0) {
+			int next;
+
+			query[queryLength++] = key;
+			query[queryLength] = '\0';
+			next = searchHistory(query, match > 0 ? match + 1 : history.count + 1);
+			failed = next == 0;
+			if (next > 0) match = next;
+		}
+		else break;
+	}
+	free(query);
+
+	if (key == CTRL('G') || key == -1) match = 0;
+	if (match > 0) {
+		size_t matchLength = strlen(indexedEntry(match));
+		if (growLine(line, capacity, matchLength + 2) == 0) {
+			memcpy(*line, indexedEntry(match), matchLength);
+			*length = matchLength;
+		}
+	}
+	return key == CTRL('G') ? 0 : key;
+}
+
+/**
+* Method used to read a line. In the terminal the keys go through the line
+* editor, which draws the line again after each one in a single write;
+* otherwise the line is read as it comes. It returns the length of the
+* line with its line break, or -1 at the end of the input.
+*/
+ssize_t readLine(char** line, size_t* capacity) {
+	int full = 0;
+	int key;
+
+	if (!GBSH_IS_INTERACTIVE) return getline(line, capacity, stdin);
+
+	fflush(stdout);
+	if (growLine(line, capacity, 2) == -1) return -1;
+	editor.line = line;
+	editor.capacity = capacity;
+	editor.length = editor.cursor = editor.offset = 0;
+	editor.shownLength = 0;
+	editor.shownCursor = 0;
+	editor.columns = terminalColumns();
+	editor.historyPosition = history.count + 1;
+	editor.lastKey = 0;
+	free(editor.draft);
+	editor.draft = NULL;
+	windowResized = 0;
+	lineInterrupted = 0;
+	rawMode(1);
+
+	while ((key = readKey()) != '\r' && key != '\n') {
+		if (key == CTRL('R')) {
+			key = reverseSearch(line, capacity, &editor.length);
+			editor.cursor = editor.length;
+			full = 1;
+		}
+		// Ctrl+C drops the line, the end of the input ends an empty one
+		if (key == -1 && lineInterrupted) editor.length = 0;
+		if (key == -1 || (key == CTRL('D') && editor.length == 0)) {
+			if (lineInterrupted || editor.length > 0) break;
+			rawMode(0);
+			return -1;
+		}
+		if (key == '\r' || key == '\n') break;
+		if (key == 27) key = readEscape();
+		full |= editKey(key);
+		editor.lastKey = key;
+		// The keys of a paste are drawn once, after the last of them
+		if (!keyPending()) {
+			refreshLine(full);
+			editorFlush();
+			full = 0;
+		}
+	}
+	// The whole line is left on the screen before the line break
+	if (lineInterrupted) editor.outputLength = 0;
+	else {
+		editor.cursor = editor.length;
+		refreshLine(full);
+		editorWrite("\n", 1);
+		editorFlush();
+	}
+	rawMode(0);
+
+	(*line)[editor.length++] = '\n';
+	(*line)[editor.length] = '\0';
+	return editor.length;
+}
+
+/**
+ * COMPLETION
+ */
+
+/**
+* Method used to find the node of the trie where name ends. With create the
+* missing nodes are added, in the order of their key.
+*/
+struct trieNode* findTrieNode(const char* name, size_t length, int create) {
+	struct trieNode* node = &pathIndex.root;
+
+	for (size_t i = 0; i < length; i++) {
+		unsigned char key = name[i];
+		struct trieNode** link = &node->child;
+
+		while (*link != NULL && (*link)->key < key) link = &(*link)->next;
+		if (*link == NULL || (*link)->key != key) {
+			struct trieNode* child;
+
+			if (!create) return NULL;
+			child = arenaAlloc(&pathIndex.nodes, sizeof(struct trieNode));
+			memset(child, 0, sizeof(struct trieNode));
+			child->key = key;
+			child->next = *link;
+			*link = child;
+		}
+		node = *link;
+	}
+	return node;
+}
+
+/**
+* Method used to add a name of a directory of $PATH to the index, or to
+* remove it when present is 0. The counts of the nodes above it only change
+* when the name was in no directory before, or is in none now.
+*/
+void indexName(const char* name, int directory, int present) {
+	size_t length = strlen(name);
+	struct trieNode* node = findTrieNode(name, length, present);
+	int was, delta;
+
+	if (node == NULL || length == 0) return;
+	was = node->directories != 0;
+	if (present) node->directories |= 1ULL << directory;
+	else node->directories &= ~(1ULL << directory);
+	if (was == (node->directories != 0)) return;
+
+	delta = was ? -1 : 1;
+	node = &pathIndex.root;
+	node->names += delta;
+	for (size_t i = 0; i < length; i++) {
+		for (node = node->child; node->key != (unsigned char)name[i]; node = node->next);
+		node->names += delta;
+	}
+}
+
+/**
+* Method used to know if an entry of a directory of $PATH is a command: a
+* regular file that can be executed. The type the directory gives saves
+* the stat of most entries.
+*/
+int pathExecutable(int dirFd, const char* name, unsigned char type) {
+	struct stat sb;
+
+	if (type == DT_DIR) return 0;
+	if (type != DT_REG && (fstatat(dirFd, name, &sb, 0) == -1 || !S_ISREG(sb.st_mode))) return 0;
+	return faccessat(dirFd, name, X_OK, 0) == 0;
+}
+
+/**
+* Method used to add the commands of a directory of $PATH to the index
+*/
+void scanPathDirectory(int directory) {
+	DIR* dir = opendir(pathIndex.directories[directory]);
+	struct dirent* entry;
+
+	if (dir == NULL) return;
+	while ((entry = readdir(dir)) != NULL)
+		if (pathExecutable(dirfd(dir), entry->d_name, entry->d_type)) indexName(entry->d_name, directory, 1);
+	closedir(dir);
+}
+
+/**
+* Method used to drop the index of $PATH. Its nodes go back to the arena.
+*/
+void clearPathIndex(void) {
+	// Closing the inotify descriptor removes its watches
+	if (pathIndex.notifyFd != -1) close(pathIndex.notifyFd);
+	pathIndex.notifyFd = -1;
+	for (int i = 0; i < pathIndex.count; i++) free(pathIndex.directories[i]);
+	pathIndex.count = 0;
+	free(pathIndex.path);
+	pathIndex.path = NULL;
+	memset(&pathIndex.root, 0, sizeof(pathIndex.root));
+	arenaReset(&pathIndex.nodes);
+	pathIndex.built = 0;
+}
+
+/**
+* Method used to apply the changes inotify reported in the directories of
+* $PATH since the last Tab. The command table forgets where a changed name
+* was too. When the queue overflowed or a directory went away, the index is
+* built again.
+*/
+void readPathEvents(void) {
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+
+	while ((n = read(pathIndex.notifyFd, buffer, sizeof(buffer))) > 0) {
+		for (char* p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+			struct inotify_event* event = (struct inotify_event*)p;
+			int directory = 0;
+			int dirFd;
+
+			if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+				pathIndex.built = 0;
+				continue;
+			}
+			while (directory < pathIndex.count && pathIndex.watches[directory] != event->wd) directory++;
+			if (directory == pathIndex.count || event->len == 0) continue;
+
+			forgetCommand(event->name);
+			if (event->mask & (IN_DELETE | IN_MOVED_FROM)) indexName(event->name, directory, 0);
+			else if ((dirFd = open(pathIndex.directories[directory], O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+				indexName(event->name, directory, pathExecutable(dirFd, event->name, DT_UNKNOWN));
+				close(dirFd);
+			}
+		}
+	}
+}
+
+/**
+* Method used to have the index of $PATH ready for a Tab. It is built when
+* $PATH changed or the index is stale, otherwise only the changes inotify
+* reported are applied. Directories that are not absolute are left out,
+* they change with every cd.
+*/
+void updatePathIndex(void) {
+	const char* path = getVariable("PATH");
+
+	if (path == NULL) path = "/usr/local/bin:/usr/bin:/bin";
+	if (pathIndex.built && strcmp(pathIndex.path, path) == 0) {
+		readPathEvents();
+		if (pathIndex.built) return;
+	}
+	clearPathIndex();
+	pathIndex.path = strdup(path);
+	pathIndex.notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	while (*path != '\0' && pathIndex.count < PATH_INDEX_DIRECTORIES) {
+		const char* end = strchrnul(path, ':');
+		char* directory = strndup(path, end - path);
+		int watch = -1;
+		int duplicate = 0;
+
+		// The watch is added before the directory is read, so nothing
+		// created in between is missed. A directory without a watch is
+		// read again only by rehash.
+		if (directory[0] == '/' && pathIndex.notifyFd != -1)
+			watch = inotify_add_watch(pathIndex.notifyFd, directory, PATH_INDEX_EVENTS);
+		// The same directory twice in $PATH gets the same watch
+		for (int i = 0; i < pathIndex.count && watch != -1; i++)
+			if (pathIndex.watches[i] == watch) duplicate = 1;
+
+		if (directory[0] != '/' || duplicate) free(directory);
+		else {
+			pathIndex.directories[pathIndex.count] = directory;
+			pathIndex.watches[pathIndex.count] = watch;
+			scanPathDirectory(pathIndex.count++);
+		}
+		path = *end == ':' ? end + 1 : end;
+	}
+	pathIndex.built = 1;
+}
+
+/**
+* Method used to sort the names of a listing, the hidden ones first
+*/
+int compareListedNames(const void* a, const void* b) {
+	const char* x = *(const char**)a;
+	const char* y = *(const char**)b;
+
+	if ((x[0] == '.') != (y[0] == '.')) return x[0] == '.' ? -1 : 1;
+	return strcmp(x, y);
+}
+
+/**
+* Method used to free a listing of a directory
+*/
+void freeListing(struct directoryListing* listing) {
+	free(listing->path);
+	free(listing->text);
+	free(listing->names);
+	free(listing);
+}
+
+/**
+* Method used to read the names of a directory, sorted, with a '/' after
+* the names of directories
+*/
+struct directoryListing* readListing(const char* path, struct stat* sb) {
+	struct directoryListing* listing;
+	size_t textLength = 0;
+	size_t textCapacity = 0;
+	struct dirent* entry;
+	struct stat entrySb;
+	DIR* dir;
+	char* name;
+
+	if ((dir = opendir(path)) == NULL) return NULL;
+	listing = calloc(1, sizeof(struct directoryListing));
+	while ((entry = readdir(dir)) != NULL) {
+		size_t length = strlen(entry->d_name);
+		int directory = entry->d_type == DT_DIR;
+
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+		// Links, and file systems that give no type, need a stat
+		if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+			directory = fstatat(dirfd(dir), entry->d_name, &entrySb, 0) == 0 && S_ISDIR(entrySb.st_mode);
+		if (growLine(&listing->text, &textCapacity, textLength + length + 2) == -1) break;
+		memcpy(listing->text + textLength, entry->d_name, length);
+		textLength += length;
+		if (directory) listing->text[textLength++] = '/';
+		listing->text[textLength++] = '\0';
+		listing->count++;
+	}
+	closedir(dir);
+
+	if ((listing->names = malloc((listing->count + 1) * sizeof(char*))) == NULL) {
+		freeListing(listing);
+		return NULL;
+	}
+	name = listing->text;
+	for (int i = 0; i < listing->count; i++) {
+		listing->names[i] = name;
+		if (name[0] == '.') listing->hidden++;
+		name += strlen(name) + 1;
+	}
+	qsort(listing->names, listing->count, sizeof(char*), compareListedNames);
+	listing->path = strdup(path);
+	listing->modified = sb->st_mtim;
+	listing->inode = sb->st_ino;
+	listing->device = sb->st_dev;
+	return listing;
+}
+
+/**
+* Method used to get the listing of a directory from the cache. The
+* directory is read again only when its modification time changed, which
+* happens whenever a name is added to it, removed or renamed.
+*/
+struct directoryListing* listDirectory(const char* directory) {
+	struct directoryListing** link = &directoryCache;
+	struct directoryListing* listing;
+	struct stat sb;
+	int kept = 0;
+	char* path;
+
+	// Relative directories are kept by their absolute path
+	if (directory[0] == '/' || currentDirectory == NULL) path = strdup(directory);
+	else if (asprintf(&path, "%s/%s", currentDirectory, directory) == -1) path = NULL;
+	if (path == NULL || stat(path, &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+		free(path);
+		return NULL;
+	}
+
+	while ((listing = *link) != NULL && strcmp(listing->path, path) != 0) link = &listing->next;
+	if (listing != NULL) {
+		*link = listing->next;
+		if (listing->modified.tv_sec != sb.st_mtim.tv_sec || listing->modified.tv_nsec != sb.st_mtim.tv_nsec ||
+			listing->inode != sb.st_ino || listing->device != sb.st_dev) {
+			freeListing(listing);
+			listing = NULL;
+		}
+	}
+	if (listing == NULL) listing = readListing(path, &sb);
+	free(path);
+	if (listing == NULL) return NULL;
+
+	// The listing goes first, and the least recent one goes when the
+	// cache is full
+	listing->next = directoryCache;
+	directoryCache = listing;
+	for (link = &directoryCache; *link != NULL; link = &(*link)->next) {
+		if (kept++ == DIRECTORY_CACHE_SIZE) {
+			freeListing(*link);
+			*link = NULL;
+			break;
+		}
+	}
+	return listing;
+}
+
+/**
+* Method used to count count names that match, which all start with name.
+* The text the names share is cut down to what name shares with it.
+*/
+void matchCompletion(const char* name, size_t length, int count) {
+	size_t common = 0;
+
+	if (completion.count == 0) {
+		if (growLine(&completion.common, &completion.commonCapacity, length + 1) == -1) return;
+		memcpy(completion.common, name, length);
+		completion.commonLength = length;
+	}
+	else {
+		while (common < completion.commonLength && common < length && completion.common[common] == name[common]) common++;
+		completion.commonLength = common;
+	}
+	completion.count += count;
+}
+
+/**
+* Method used to keep a name that matched for the list a second Tab shows
+*/
+void addCompletion(const char* name, size_t length) {
+	if (completion.listedCount == COMPLETION_LIST_MAX) return;
+	if (growLine(&completion.text, &completion.textCapacity, completion.textLength + length + 1) == -1) return;
+	completion.listed[completion.listedCount++] = completion.textLength;
+	memcpy(completion.text + completion.textLength, name, length);
+	completion.textLength += length;
+	completion.text[completion.textLength++] = '\0';
+}
+
+/**
+* Method used to keep the names under a node of the trie for the list, in
+* order, until the list is full
+*/
+void listTrie(struct trieNode* node, char* name, size_t length) {
+	if (node->names == 0 || completion.listedCount == COMPLETION_LIST_MAX) return;
+	if (node->directories != 0) addCompletion(name, length);
+	for (struct trieNode* child = node->child; child != NULL; child = child->next) {
+		name[length] = child->key;
+		listTrie(child, name, length + 1);
+	}
+}
+
+/**
+* Method used to complete the name of a command from the index of $PATH
+* and the builtins. The node of the prefix knows how many names are under
+* it, the text they share is found by following the trie while it does not
+* branch, and only the names to list are visited.
+*/
+void completeCommand(const char* prefix, size_t length) {
+	char name[NAME_MAX + 1];
+	struct trieNode* node;
+
+	completion.typed = length;
+	updatePathIndex();
+	if (length <= NAME_MAX && (node = findTrieNode(prefix, length, 0)) != NULL && node->names > 0) {
+		int names = node->names;
+
+		memcpy(name, prefix, length);
+		listTrie(node, name, length);
+		while (node->directories == 0) {
+			struct trieNode* only = NULL;
+			int ways = 0;
+
+			for (struct trieNode* child = node->child; child != NULL; child = child->next) {
+				if (child->names > 0) {
+					only = child;
+					ways++;
+				}
+			}
+			if (ways != 1) break;
+			name[length++] = only->key;
+			node = only;
+		}
+		matchCompletion(name, length, names);
+	}
+
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+		const char* builtin = builtins[i].name;
+		size_t builtinLength = strlen(builtin);
+
+		if (strncmp(builtin, prefix, completion.typed) != 0) continue;
+		// A builtin with the name of a command of $PATH is counted once
+		if ((node = findTrieNode(builtin, builtinLength, 0)) != NULL && node->directories != 0) continue;
+		matchCompletion(builtin, builtinLength, 1);
+		addCompletion(builtin, builtinLength);
+	}
+}
+
+/**
+* Method used to complete the name of a file from the cached listing of its
+* directory. The names are sorted, so the ones that match are next to each
+* other: two binary searches find them, and the text they all share is the
+* text the first and the last share.
+*/
+void completeFile(const char* word, size_t length) {
+	const char* slash = memrchr(word, '/', length);
+	const char* base = slash != NULL ? slash + 1 : word;
+	size_t baseLength = word + length - base;
+	struct directoryListing* listing;
+	char** names;
+	char* directory;
+	int low, high, first, last;
+	size_t common = 0;
+
+	completion.typed = baseLength;
+	if (slash == NULL) directory = strdup(".");
+	else if (slash == word) directory = strdup("/");
+	else directory = strndup(word, slash - word);
+	listing = directory != NULL ? listDirectory(directory) : NULL;
+	free(directory);
+	if (listing == NULL) return;
+
+	// The hidden names are completed only when the word starts with a dot
+	names = listing->names;
+	low = baseLength > 0 && base[0] == '.' ? 0 : listing->hidden;
+	high = baseLength > 0 && base[0] == '.' ? listing->hidden : listing->count;
+	last = high;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (strncmp(names[middle], base, baseLength) < 0) low = middle + 1;
+		else high = middle;
+	}
+	first = low;
+	for (high = last; low < high;) {
+		int middle = (low + high) / 2;
+		if (strncmp(names[middle], base, baseLength) <= 0) low = middle + 1;
+		else high = middle;
+	}
+	last = low;
+	if (first == last) return;
+
+	while (names[first][common] != '\0' && names[first][common] == names[last - 1][common]) common++;
+	matchCompletion(names[first], common, last - first);
+	for (int i = first; i < last && completion.listedCount < COMPLETION_LIST_MAX; i++)
+		addCompletion(names[i], strlen(names[i]));
+}
+
+/**
+* Method used to insert completed text, with a backslash before the
+* characters the lexer would not keep in the word
+*/
+void insertCompletion(const char* text, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (charClass[(unsigned char)text[i]] & (CHAR_SPACE | CHAR_OPERATOR | CHAR_QUOTE | CHAR_DOLLAR | CHAR_GLOB))
+			insertText("\\", 1);
+		insertText(text + i, 1);
+	}
+}
+
+/**
+* Method used to list the names a Tab matched under the line, in columns
+* as wide as the longest name
+*/
+void showCompletions(void) {
+	char* names[COMPLETION_LIST_MAX];
+	int width = 0;
+	int perRow, rows;
+	char more[32];
+
+	for (int i = 0; i < completion.listedCount; i++) {
+		names[i] = completion.text + completion.listed[i];
+		if (textColumns(names[i], strlen(names[i])) > width) width = textColumns(names[i], strlen(names[i]));
+	}
+	qsort(names, completion.listedCount, sizeof(char*), compareListedNames);
+	width += 2;
+	perRow = editor.columns / width > 0 ? editor.columns / width : 1;
+	rows = (completion.listedCount + perRow - 1) / perRow;
+
+	// The names go down the columns, like ls shows them
+	editorWrite("\n", 1);
+	for (int row = 0; row < rows; row++) {
+		for (int column = 0; column < perRow; column++) {
+			int i = column * rows + row;
+			if (i >= completion.listedCount) break;
+			editorWrite(names[i], strlen(names[i]));
+			if ((column + 1) * rows + row < completion.listedCount)
+				for (int pad = width - textColumns(names[i], strlen(names[i])); pad > 0; pad--) editorWrite(" ", 1);
+		}
+		editorWrite("\n", 1);
+	}
+	if (completion.count > completion.listedCount)
+		editorWrite(more, snprintf(more, sizeof(more), "(%d more)\n", completion.count - completion.listedCount));
+}
+
+/**
+* Method used to complete the word before the cursor: the name of a command
+* where a command starts, and the name of a file anywhere else or when the
+* word has a '/'. A single match is completed with a space after it, or the
+* '/' of a directory; several are completed as far as they agree, and a
+* second Tab lists them. It returns 1 when the list was written and the
+* line has to be drawn again.
+*/
+int completeLine(int listing) {
+	const char* keywords[] = { "if", "then", "else" };
+	char* line = *editor.line;
+	size_t start = editor.cursor;
+	size_t before, keyword, length = 0;
+	int command;
+	char* word;
+
+	// The word goes back to a space or an operator that is not escaped
+	while (start > 0 && (!(charClass[(unsigned char)line[start - 1]] & (CHAR_SPACE | CHAR_OPERATOR)) ||
+		(start > 1 && line[start - 2] == '\\')))
+		start--;
+	// Quoted words are left alone
+	for (size_t i = start; i < editor.cursor; i++)
+		if (line[i] != '\\' && (charClass[(unsigned char)line[i]] & CHAR_QUOTE)) return 0;
+	if ((word = malloc(editor.cursor - start + 1)) == NULL) return 0;
+	for (size_t i = start; i < editor.cursor; i++) {
+		if (line[i] == '\\' && i + 1 < editor.cursor) i++;
+		word[length++] = line[i];
+	}
+	word[length] = '\0';
+
+	// A command starts the line, follows an operator or a keyword of if
+	for (before = start; before > 0 && (charClass[(unsigned char)line[before - 1]] & CHAR_SPACE); before--);
+	command = before == 0 || (charClass[(unsigned char)line[before - 1]] & CHAR_OPERATOR);
+	for (keyword = before; keyword > 0 && !(charClass[(unsigned char)line[keyword - 1]] & (CHAR_SPACE | CHAR_OPERATOR)); keyword--);
+	for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]) && !command; i++)
+		command = before - keyword == strlen(keywords[i]) && strncmp(line + keyword, keywords[i], before - keyword) == 0;
+
+	completion.count = 0;
+	completion.commonLength = 0;
+	completion.textLength = 0;
+	completion.listedCount = 0;
+	if (command && memchr(word, '/', length) == NULL) completeCommand(word, length);
+	else completeFile(word, length);
+	free(word);
+
+	if (completion.count == 0) {
+		editorWrite("\a", 1);
+		return 0;
+	}
+	// The text several names share does not end inside a character
+	if (completion.count > 1) {
+		size_t end = completion.commonLength;
+		while (end > 0 && ((unsigned char)completion.common[end - 1] & 0xc0) == 0x80) end--;
+		if (end > 0 && (unsigned char)completion.common[end - 1] >= 0xc0) {
+			unsigned char lead = completion.common[end - 1];
+			size_t size = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : 2;
+			if (completion.commonLength - (end - 1) < size) completion.commonLength = end - 1;
+		}
+	}
+	if (completion.commonLength > completion.typed) {
+		insertCompletion(completion.common + completion.typed, completion.commonLength - completion.typed);
+		if (completion.count == 1 && completion.common[completion.commonLength - 1] != '/') insertText(" ", 1);
+		return 0;
+	}
+	if (completion.count == 1) {
+		if (completion.commonLength == 0 || completion.common[completion.commonLength - 1] != '/') insertText(" ", 1);
+		return 0;
+	}
+	if (!listing) {
+		editorWrite("\a", 1);
+		return 0;
+	}
+	showCompletions();
+	return 1;
+}
+
+/**
+ * SCRIPT INPUT
+ */
+
+/**
+* Method used to read a script from a file, or from stdin when path is
+* NULL. A regular file is mapped at once; a pipe is read in big blocks.
+*/
+int openScript(const char* path) {
+	struct stat sb;
+
+	scriptInput.fd = path == NULL ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+	if (scriptInput.fd == -1 || fstat(scriptInput.fd, &sb) == -1) return -1;
+	scriptInput.active = 1;
+
+	if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+		void* map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, scriptInput.fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, sb.st_size, MADV_SEQUENTIAL);
+			scriptInput.data = map;
+			scriptInput.size = sb.st_size;
+			scriptInput.mapped = 1;
+		}
+	}
+	return 0;
+}
+
+/**
+* Method used to run the string given with -c as a script
+*/
+void openScriptString(const char* string) {
+	scriptInput.fd = -1;
+	scriptInput.active = 1;
+	scriptInput.data = string;
+	scriptInput.size = strlen(string);
+}
+
+/**
+* Method used to read more of a script that is not mapped. What is left of
+* the current block is kept at its start, and the block grows when a
+* single line does not fit in it. It returns the number of bytes read.
+*/
+ssize_t fillScript(void) {
+	size_t left = scriptInput.size - scriptInput.position;
+	ssize_t n;
+
+	if (scriptInput.block == NULL || left == scriptInput.blockCapacity) {
+		size_t capacity = scriptInput.blockCapacity == 0 ? SCRIPT_BLOCK_SIZE : scriptInput.blockCapacity * 2;
+		char* block = malloc(capacity);
+
+		if (block == NULL) return -1;
+		if (left > 0) memcpy(block, scriptInput.data + scriptInput.position, left);
+		free(scriptInput.block);
+		scriptInput.block = block;
+		scriptInput.blockCapacity = capacity;
+	}
+	else if (left > 0) memmove(scriptInput.block, scriptInput.data + scriptInput.position, left);
+
+	scriptInput.data = scriptInput.block;
+	scriptInput.position = 0;
+	scriptInput.size = left;
+	while ((n = read(scriptInput.fd, scriptInput.block + left, scriptInput.blockCapacity - left)) == -1 && errno == EINTR);
+	if (n > 0) scriptInput.size += n;
+	return n;
+}
+
+/**
+* Method used to read the next line of the script into line, with its line
+* break. It returns the length of the line, or -1 at the end of the script.
+*/
+ssize_t readScriptLine(char** line, size_t* capacity) {
+	const char* start;
+	const char* end;
+	size_t length;
+
+	// A command may have read stdin past the line that ran it
+	if (scriptInput.mapped && scriptInput.fd == STDIN_FILENO) {
+		off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+		if (offset >= 0) scriptInput.position = offset;
+	}
+
+	while (TRUE) {
+		start = scriptInput.data + scriptInput.position;
+		end = scriptInput.position < scriptInput.size ? memchr(start, '\n', scriptInput.size - scriptInput.position) : NULL;
+		if (end != NULL || scriptInput.mapped || scriptInput.fd == -1) break;
+		if (fillScript() <= 0) {
+			start = scriptInput.data + scriptInput.position;
+			break;
+		}
+	}
+
+	if (scriptInput.position >= scriptInput.size) return -1;
+	// The last line may not end with a line break
+	if (end == NULL) end = scriptInput.data + scriptInput.size;
+	length = end - start;
+	if (growLine(line, capacity, length + 2) == -1) return -1;
+
+	memcpy(*line, start, length);
+	(*line)[length++] = '\n';
+	(*line)[length] = '\0';
+	// The position never goes past the end of what is read
+	scriptInput.position = end - scriptInput.data + (end < scriptInput.data + scriptInput.size);
+	// The commands of a script read from stdin go on reading stdin after
+	// the line that runs them. A pipe is read ahead in blocks, so they only
+	// see what the shell did not read yet.
+	if (scriptInput.mapped && scriptInput.fd == STDIN_FILENO)
+		lseek(STDIN_FILENO, scriptInput.position, SEEK_SET);
+	return length;
+}
+
+// The benchmarks compile the shell without its main
+#ifndef SHELL_NO_MAIN
+/**
+* Main method of our shell
+*/
+int main(int argc, char* argv[], char** envp) {
+	char* line = NULL; // buffer for the user input, grown as needed
+	size_t lineCapacity = 0;
+	char** tokens; // the tokens of the line, slices of the line itself
+	int numTokens;
+	struct node* root; // the command tree of the line
+
+	no_reprint_prmpt = 0; 	// to prevent the printing of the shell
+							// after certain methods
+	// A script comes from -c, from a file or from a stdin that is not the
+	// terminal
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+			exit(2);
+		}
+		openScriptString(argv[2]);
+	}
+	else if (argc > 1 && openScript(argv[1]) == -1) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+		exit(127);
+	}
+	else if (argc == 1 && !isatty(STDIN_FILENO)) openScript(NULL);
+
+	// The variables of the shell start as the environment it was given,
+	// the children are launched with the exported ones
+	initVariables(envp);
+
+	// We call the method of initialization and the welcome screen
+	init();
+	setVariable("shell", currentDirectory, 1);
+	initLexer();
+
+	// The trace can be turned on from the environment
+	if (getVariable("SHELL_TRACE") != NULL) openTrace(getVariable("SHELL_TRACE"));
+
+	// The history of the previous sessions is indexed once. Scripts do
+	// not use the history.
+	if (GBSH_IS_INTERACTIVE) loadHistory();
+
+	// Main loop, where the user input will be read and the prompt
+	// will be printed
+	while (TRUE) {
+		if (scriptInput.active) {
+			// The jobs of a script are reaped silently, wait gets their status
+			if (jobList != NULL) reapJobs();
+			// A script ends with the status of its last command
+			if (readScriptLine(&line, &lineCapacity) == -1) exit(lastStatus);
+		}
+		else {
+			// The jobs that changed are reported together before the prompt
+			if (jobList != NULL) notifyJobs();
+			// While the user types, the trace can be written
+			if (trace.length > 0) flushTrace();
+
+			// We print the shell prompt if necessary
+			if (no_reprint_prmpt == 0) shellPrompt();
+			no_reprint_prmpt = 0;
+
+			// We wait for user input, the line can have any length
+			if (readLine(&line, &lineCapacity) == -1) exit(0);
+
+			// A line that recalls the history is replaced by the entry first
+			if (expandHistory(&line, &lineCapacity) == -1) continue;
+
+			// Save the line in history
+			if (line[0] != ' ' && line[0] != '\n')
+				saveHistory(line);
+		}
+
+		trace.lines++;
+
+		// Everything the previous line allocated is released at once
+		arenaReset(&lineArena);
+
+		// We split the line in tokens. If nothing is written, the loop
+		// is executed again
+		if ((numTokens = tokenize(line)) <= 0) continue;
+		tokens = lineTokens;
+
+		// The line is parsed once into a tree, which is then executed
+		root = parseLine(tokens);
+		if (root != NULL) executeNode(root);
+		else lastStatus = 2;
+	}
 	exit(0);
 }
+#endif
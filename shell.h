@@ -7,35 +7,612 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #define TRUE 1
 #define FALSE !TRUE
 
-#ifndef MAX
-#define MAX 1024
-#endif
-
-static char buffer[MAX];
-
 // Shell pid, pgid, terminal modes
 static pid_t GBSH_PID;
 static pid_t GBSH_PGID;
 static int GBSH_IS_INTERACTIVE;
 static struct termios GBSH_TMODES;
 const char * historyFileName = "history.txt";
-static int historyCount;
-static char * actualHistory;
 
+// History: the recent entries are kept in a ring, every entry is appended
+// to a log and an index of their offsets in the log finds any of them
+#define HISTORY_RING_SIZE 1024
+#define HISTORY_BUFFER_SIZE 8192
+#define HISTORY_SYNC_INTERVAL 1
+#define HISTORY_MAX_SIZE (16 << 20)
+#define HISTORY_KEEP 100000
+#define HISTORY_KEEP_SIZE (HISTORY_MAX_SIZE / 2)
+
+struct historyStore {
+	char* path;
+	int fd;
+	off_t size; // size of the log, with the entries still pending
+	off_t flushedSize; // size of the log that is written
+	off_t* offsets; // offset of every entry in the log
+	int count;
+	int capacity;
+	char* ring[HISTORY_RING_SIZE];
+	char pending[HISTORY_BUFFER_SIZE];
+	size_t pendingLength;
+	time_t lastSync;
+	int compacting; // the log is loaded again after it was compacted
+};
+static struct historyStore history = { .fd = -1 };
+
+// Trigram index of the history for the reverse search. It is built from
+// the log the first time it is needed and then grows with every entry.
+struct trigramPosting {
+	unsigned int trigram;
+	int* entries; // numbers of the entries that contain it, sorted
+	int count;
+	int capacity;
+	struct trigramPosting* next;
+};
+
+struct historyIndex {
+	int built;
+	char* text; // the entries, each one ended by '\0'
+	size_t textLength;
+	size_t textCapacity;
+	size_t* offsets; // where each entry starts in text
+	int count;
+	int capacity;
+	struct trigramPosting** table;
+	int tableBits;
+	int tableCount;
+};
+static struct historyIndex historyIndex;
+
+// Input of a script: a mapped file, the string of -c, or a pipe read in
+// blocks of SCRIPT_BLOCK_SIZE bytes
+#define SCRIPT_BLOCK_SIZE 65536
+
+struct scriptInput {
+	int active;
+	int fd;
+	const char* data; // what is read of the script
+	size_t size;
+	size_t position; // start of the next line in data
+	int mapped;
+	char* block;
+	size_t blockCapacity;
+};
+static struct scriptInput scriptInput = { .fd = -1 };
+
+// Prompt, built again only when the directory or the host name changed.
+// The kernel wakes a poll on hostnameFd when the host name changes.
+struct promptCache {
+	char* text;
+	size_t length;
+	int columns;
+	int dirty;
+	int hostnameFd;
+	char hostname[256];
+};
+static struct promptCache prompt = { .dirty = 1, .hostnameFd = -1 };
+
+// The flag Ctrl+C raises to drop the line being read, and the one the
+// terminal raises when its size changes
+static volatile sig_atomic_t lineInterrupted;
+static volatile sig_atomic_t windowResized;
 
+// Line editor: the line, where the cursor is in it, and what the terminal
+// shows of it, so a key only writes what changed. A line wider than the
+// terminal scrolls, offset is its first byte on the screen.
+struct lineEditor {
+	char** line;
+	size_t* capacity;
+	size_t length;
+	size_t cursor;
+	size_t offset;
+	int columns; // width of the terminal
+	char* shown; // text after the prompt on the terminal
+	size_t shownLength;
+	size_t shownCapacity;
+	int shownCursor; // column of the cursor after the prompt
+	int historyPosition; // entry shown by Up and Down, count + 1 is the draft
+	int lastKey; // a second Tab in a row lists the completions
+	char* draft; // line being written before going through the history
+	char* killed; // text Ctrl+K, Ctrl+U, Ctrl+W and Alt+D cut, Ctrl+Y pastes it
+	size_t killedLength;
+	size_t killedCapacity;
+	char* output; // what a key writes, sent in one write
+	size_t outputLength;
+	size_t outputCapacity;
+};
+static struct lineEditor editor;
+
+// Keys of the escape sequences, after the bytes a key can send
+#define KEY_UP 256
+#define KEY_DOWN 257
+#define KEY_RIGHT 258
+#define KEY_LEFT 259
+#define KEY_HOME 260
+#define KEY_END 261
+#define KEY_DELETE 262
+#define KEY_WORD_LEFT 263
+#define KEY_WORD_RIGHT 264
+#define KEY_WORD_DELETE 265
+#define KEY_WORD_RUBOUT 266
+
+#ifndef CTRL
+#define CTRL(key) ((key) & 0x1f)
+#endif
+
+
+// The current directory, asked for again only after a cd
 static char* currentDirectory;
-extern char** environ;
 
 struct sigaction act_child;
 struct sigaction act_int;
+struct sigaction act_winch;
 
 int no_reprint_prmpt;
 
-pid_t pid;
+// Job table. A job is a pipeline, or a subshell, launched in the background
+// or stopped; its processes share a process group. Jobs are found by their
+// process group and their processes by pid, and SIGCHLD only writes to
+// selfPipe so they are reaped outside of the handler.
+#define JOB_RUNNING 0
+#define JOB_STOPPED 1
+#define JOB_DONE 2
+#define JOB_TABLE_BITS 8
+#define JOB_TABLE_SIZE (1 << JOB_TABLE_BITS)
+
+struct jobProcess {
+	pid_t pid;
+	int state;
+	int status;
+	struct job* job;
+	struct jobProcess* next; // next process in the same bucket
+};
+
+struct job {
+	int id;
+	pid_t pgid;
+	int state;
+	int notify; // the state changed since the last prompt
+	int signal; // signal that ended the job
+	int count;
+	int running;
+	int done;
+	char* command;
+	struct jobProcess* processes;
+	struct job* next; // next job in the same bucket
+	struct job* nextJob; // next job by number
+};
+
+static struct job* jobTable[JOB_TABLE_SIZE];
+static struct jobProcess* processTable[JOB_TABLE_SIZE];
+static struct job* jobList;
+static int selfPipe[2] = { -1, -1 };
+
+// A job of the parallel builtin, with the memory file that holds its output
+#define PARALLEL_MAX_JOBS 1024
+
+struct parallelJob {
+	pid_t pid;
+	int pidfd;
+	int output;
+	char** argv;
+};
+
+// What the kernel is asked to move at a time by cat and tee, and the
+// buffer used when it refuses
+#define MOVE_CHUNK_SIZE (1 << 30)
+#define MOVE_BUFFER_SIZE (256 * 1024)
+#define TEE_MAX_FILES 64
+
+// Bytes moved in the kernel by cat and tee, which /proc does not count
+static long long movedBytes;
+
+// Spawn backends used to launch external programs
+#define SPAWN_POSIX 0
+#define SPAWN_FORK 1
+
+// posix_spawn can give the terminal to the child since glibc 2.35
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+
+// Size of the chunks the arenas take from malloc
+#define ARENA_CHUNK_SIZE 65536
+
+// Chunk of memory of an arena, allocations are taken from data in order
+struct arenaChunk {
+	struct arenaChunk* next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+// Bump allocator released all at once
+struct arena {
+	struct arenaChunk* first;
+	struct arenaChunk* current;
+};
+
+// Arena of the line being executed: tokens, commands and redirections
+static struct arena lineArena;
+
+// Index of the executables of $PATH for the completion of command names.
+// It is a trie of the names where every name has the set of directories it
+// is in, built the first time Tab needs it; inotify watches on the
+// directories keep it current, so Tab never reads them again.
+#define PATH_INDEX_DIRECTORIES 64
+#define PATH_INDEX_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct trieNode {
+	struct trieNode* child; // first child, the children are sorted by key
+	struct trieNode* next;
+	unsigned long long directories; // directories of $PATH the name that ends here is in
+	int names; // names in the subtree
+	unsigned char key;
+};
+
+struct pathIndex {
+	int built;
+	char* path; // value of $PATH the index is for
+	int notifyFd;
+	char* directories[PATH_INDEX_DIRECTORIES];
+	int watches[PATH_INDEX_DIRECTORIES];
+	int count;
+	struct trieNode root;
+	struct arena nodes;
+};
+static struct pathIndex pathIndex = { .notifyFd = -1 };
+
+// Listings of the directories for the completion of file names, the most
+// recent first. A listing is read again only when the modification time of
+// its directory changed. The hidden names are sorted before the others and
+// the names of directories end with '/'.
+#define DIRECTORY_CACHE_SIZE 32
+
+struct directoryListing {
+	char* path;
+	struct timespec modified;
+	ino_t inode;
+	dev_t device;
+	char* text; // the names one after the other
+	char** names;
+	int count;
+	int hidden;
+	struct directoryListing* next;
+};
+static struct directoryListing* directoryCache;
+
+// Names a Tab matched: how many, the text all of them start with, and the
+// first COMPLETION_LIST_MAX of them to list on a second Tab
+#define COMPLETION_LIST_MAX 100
+
+struct completion {
+	int count;
+	size_t typed; // length of the part of the word the names complete
+	char* common;
+	size_t commonLength;
+	size_t commonCapacity;
+	char* text;
+	size_t textLength;
+	size_t textCapacity;
+	size_t listed[COMPLETION_LIST_MAX];
+	int listedCount;
+};
+static struct completion completion;
+
+// Redirection of a command to a file, in the order they were written
+struct redirection {
+	int type;
+	char* file;
+	struct redirection* next;
+};
+
+// Command of a pipeline: a simple command with its arguments, or an if
+// (compound), and its redirections. The assignments written before the
+// command name are NAME=VALUE words.
+struct command {
+	char** argv;
+	int argc;
+	struct node* compound;
+	struct redirection* redirections;
+	char** assignments;
+	int assignmentCount;
+};
+
+// Commands connected with pipes
+struct pipeline {
+	struct command* stages;
+	int count;
+	int background;
+	int timed;
+};
+
+// What a stage of a timed or traced pipeline spent
+struct stageTime {
+	struct timespec start;
+	struct timespec end;
+	struct rusage usage;
+	pid_t pid;
+	double spawnMicros;
+	long long readBytes;
+	long long writtenBytes;
+};
+
+// Trace of the commands, one JSON line each. The records are built in the
+// buffer and written when it fills, and before the prompt.
+#define TRACE_BUFFER_SIZE 65536
+#define TRACE_STRING_MAX 1024
+
+struct traceWriter {
+	int fd;
+	char* path;
+	int registered;
+	char buffer[TRACE_BUFFER_SIZE];
+	size_t length;
+	size_t recordStart; // where the record being written starts
+	int overflow; // the record being written does not fit
+	long records;
+	long dropped;
+	long pipelines;
+	long lines;
+};
+static struct traceWriter trace = { .fd = -1 };
+
+// Types of the nodes of the command tree
+#define NODE_PIPELINE 0
+#define NODE_SEQUENCE 1
+#define NODE_AND 2
+#define NODE_OR 3
+#define NODE_IF 4
+#define NODE_BACKGROUND 5
+
+/**
+ * Node of the command tree of a line. Sequences, '&&' and '||' use left
+ * and right; an if keeps its condition in left, the then branch in right
+ * and the else branch in elseBranch; a background node runs left in a
+ * subshell.
+ */
+struct node {
+	int type;
+	struct node* left;
+	struct node* right;
+	struct node* elseBranch;
+	struct pipeline* pipeline;
+};
+
+// State of the recursive descent parser: the position in the tokens and
+// how many ifs are open
+struct parser {
+	char** tokens;
+	int position;
+	int depth;
+	int error;
+};
+
+/**
+ * Description of how a child is launched: the descriptors that replace its
+ * standard input and output, the files it is redirected to and the process
+ * group it joins (0 for a new one).
+ */
+struct spawnAttr {
+	int inFd;
+	int outFd;
+	int errFd;
+	struct redirection* redirections;
+	char** assignments;
+	pid_t pgid;
+	int foreground;
+};
+
+// Latency of the spawns made with each backend, in microseconds
+struct spawnStat {
+	long count;
+	double total;
+	double min;
+	double max;
+};
+
+// Remembered location of a command found in $PATH
+struct commandEntry {
+	char* name;
+	char* path;
+	long hits;
+	struct commandEntry* next;
+};
+
+// Command table used instead of scanning $PATH on every execution. It is
+// valid for the value of $PATH kept in commandTablePath.
+static struct commandEntry** commandTable;
+static int commandTableSize;
+static int commandTableCount;
+static char* commandTablePath;
+
+// Variable of the shell. Its entry is "NAME=VALUE", what the children get
+// in their environment when it is exported, and value points into it.
+struct variable {
+	char* name;
+	char* value;
+	char* entry;
+	int exported;
+	struct variable* next;
+};
+
+// Variables by name, and the environment built from the exported ones,
+// which is built again only when it is dirty
+static struct variable** variableTable;
+static int variableTableSize;
+static int variableCount;
+static char** environment;
+static int environmentDirty;
+static long commandHits;
+static long commandMisses;
+
+// Builtin may run in the shell process when it is a pipeline stage
+#define BUILTIN_INPROCESS 1
+// Builtin whose standard input and output can be redirected to files
+#define BUILTIN_REDIRECT 2
+
+// Entry of the builtin table: every builtin has the same signature
+struct builtin {
+	const char* name;
+	int (*handler)(char* args[]);
+	int flags;
+};
+
+// Redirection operators recognized by redirectionType
+#define REDIRECT_NONE 0
+#define REDIRECT_INPUT 1
+#define REDIRECT_OUTPUT 2
+#define REDIRECT_APPEND 3
+
+// Character classes used by the lexer
+#define CHAR_SPACE 1
+#define CHAR_OPERATOR 2
+#define CHAR_QUOTE 4
+#define CHAR_END 8
+#define CHAR_DOLLAR 16
+#define CHAR_MARKER 32
+#define CHAR_GLOB 64
+#define CHAR_DELIMITER (CHAR_SPACE | CHAR_OPERATOR | CHAR_QUOTE | CHAR_END | CHAR_DOLLAR | CHAR_GLOB)
+static unsigned char charClass[256];
+
+// Operators produced by the lexer. Every operator is one interned string,
+// so the parser recognizes them by address and a quoted "|" stays a word.
+#define OPERATOR_COUNT 8
+static char operatorTokens[OPERATOR_COUNT][3] = { "|", "||", "&", "&&", ";", "<", ">", ">>" };
+#define TOKEN_PIPE operatorTokens[0]
+#define TOKEN_OR operatorTokens[1]
+#define TOKEN_BACKGROUND operatorTokens[2]
+#define TOKEN_AND operatorTokens[3]
+#define TOKEN_SEMICOLON operatorTokens[4]
+#define TOKEN_INPUT operatorTokens[5]
+#define TOKEN_OUTPUT operatorTokens[6]
+#define TOKEN_APPEND operatorTokens[7]
+
+// Keywords, interned the same way when they are written without quotes
+#define KEYWORD_COUNT 5
+static char keywordTokens[KEYWORD_COUNT][5] = { "if", "then", "else", "end", "time" };
+#define TOKEN_IF keywordTokens[0]
+#define TOKEN_THEN keywordTokens[1]
+#define TOKEN_ELSE keywordTokens[2]
+#define TOKEN_END keywordTokens[3]
+#define TOKEN_TIME keywordTokens[4]
+
+// The lexer replaces each '$' that starts an expansion by a marker, which
+// tells if it was inside double quotes, and counts them. A line without
+// any is not expanded.
+#define EXPAND_MARKER '\001'
+#define EXPAND_QUOTED_MARKER '\002'
+#define EXPANSION_MARKERS "\001\002\004\005"
+static int lineExpansions;
+
+// A command substitution is its marker, the command as it was written and
+// SUBSTITUTION_END. What it prints is read SUBSTITUTION_READ_SIZE bytes or
+// more at a time.
+#define SUBSTITUTION_MARKER '\004'
+#define SUBSTITUTION_QUOTED_MARKER '\005'
+#define SUBSTITUTION_END '\003'
+#define SUBSTITUTION_READ_SIZE 65536
+static int substitutionStatus;
+
+// The lexer replaces the '*', '?' and '[' that were not quoted by markers,
+// so only those make a word a pattern. A pattern that matches nothing is
+// kept as it was written.
+#define GLOB_STAR '\006'
+#define GLOB_ANY '\016'
+#define GLOB_SET '\017'
+#define GLOB_MARKERS "\006\016\017"
+#define WORD_MARKERS EXPANSION_MARKERS GLOB_MARKERS
+
+// A component of a pattern, between two '/', is compiled once into the
+// steps every name of its directory is matched with. A component without
+// a pattern is a plain name, and "**" matches any number of directories.
+#define GLOB_LITERAL 0
+#define GLOB_ONE 1
+#define GLOB_CLASS 2
+#define GLOB_ANYTHING 3
+
+struct globStep {
+	int type;
+	const char* text; // the text of a literal step
+	size_t length;
+	const unsigned char* set; // bitmap of the bytes of a class
+};
+
+struct globComponent {
+	const char* name; // the name of a component without a pattern
+	struct globStep* steps;
+	int count;
+	int recursive; // the component is "**"
+	int hidden; // the pattern starts with a '.', so it matches hidden names
+	size_t minimum; // length a name needs at least
+	const char* suffix; // literal a name has to end with
+	size_t suffixLength;
+};
+
+// Directories are read with getdents64, GLOB_SCAN_SIZE bytes of entries at a
+// time, and the matches are sorted once at the end unless globsort is off
+#define GLOB_SCAN_SIZE (256 << 10)
+
+struct linuxDirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static char* globBuffer;
+static char* globPath; // directory being read, with the names matched so far
+static size_t globPathCapacity;
+
+// Words produced by the expansion, in the line arena
+struct wordList {
+	char** words;
+	int count;
+	int capacity;
+};
+
+// Buffer where a word is expanded before its fields are copied to the
+// arena, kept between the lines
+static char* expansionBuffer;
+static size_t expansionLength;
+static size_t expansionCapacity;
+
+// Process of the last command sent to the background, $!
+static pid_t lastBackground;
+
+// Status of the last command tree executed
+static int lastStatus;
+
+// Options changed by the set builtin. An option with a value has a check
+// that returns what is stored, or -1 when the value is not valid.
+static int optionPipefail;
+static int optionPipeSize;
+static int optionPipeStats;
+static int optionGlobSort = 1;
+
+struct shellOption {
+	const char* name;
+	int* value;
+	int (*check)(long value);
+};
+
+// Tokens of the line being executed, terminated by NULL
+static char** lineTokens;
+static int lineTokensCount;
+static int lineTokensCapacity;
+
+static int spawnBackend = SPAWN_POSIX;
+static int spawnVerbose;
+static struct spawnStat spawnStats[2];
+static const char* spawnBackendNames[2] = { "posix_spawn", "fork" };
 
 
 /**
@@ -45,6 +622,10 @@ pid_t pid;
 void signalHandler_child(int p);
 // signal handler for SIGINT
 void signalHandler_int(int p);
+// signal handler for SIGWINCH
+void signalHandler_winch(int p);
+int hostnameChanged(void);
+void buildPrompt(void);
 
 
 int changeDirectory(char * args[]);
@@ -52,5 +633,209 @@ int changeDirectory(char * args[]);
 int parseline(char* buf, char** argv);
 void eval(char* cmdline);
 int builtin_command(char** argv);
-void saveHistory(char* args);
-void loadHistory();
+const char* historyText(const char* line, const char* end);
+void rememberHistory(const char* text, size_t length);
+int indexHistory(off_t offset);
+void flushHistory(int sync);
+void closeHistory(void);
+int loadHistory(void);
+int compactHistory(void);
+void saveHistory(char* line);
+char* recallHistory(int number);
+int expandHistory(char** line, size_t* capacity);
+unsigned int trigramHash(unsigned int trigram);
+struct trigramPosting* findTrigram(unsigned int trigram, int create);
+void indexHistoryEntry(const char* text, size_t length);
+void clearHistoryIndex(void);
+int buildHistoryIndex(void);
+const char* indexedEntry(int number);
+int searchHistory(const char* query, int before);
+void rawMode(int enable);
+int growLine(char** line, size_t* capacity, size_t length);
+int readKey(void);
+int keyPending(void);
+int readEscape(void);
+int textColumns(const char* text, size_t length);
+int terminalColumns(void);
+void editorWrite(const char* text, size_t length);
+void editorMove(int from, int to);
+void editorFlush(void);
+void refreshLine(int full);
+size_t previousCharacter(size_t position);
+size_t nextCharacter(size_t position);
+int wordCharacter(unsigned char c);
+size_t previousWord(size_t position);
+size_t nextWord(size_t position);
+void insertText(const char* text, size_t length);
+void killText(size_t start, size_t end, int save);
+void setLine(const char* text, size_t length);
+void recallLine(int position);
+int editKey(int key);
+struct trieNode* findTrieNode(const char* name, size_t length, int create);
+void indexName(const char* name, int directory, int present);
+int pathExecutable(int dirFd, const char* name, unsigned char type);
+void scanPathDirectory(int directory);
+void clearPathIndex(void);
+void readPathEvents(void);
+void updatePathIndex(void);
+int compareListedNames(const void* a, const void* b);
+void freeListing(struct directoryListing* listing);
+struct directoryListing* readListing(const char* path, struct stat* sb);
+struct directoryListing* listDirectory(const char* directory);
+void matchCompletion(const char* name, size_t length, int count);
+void addCompletion(const char* name, size_t length);
+void listTrie(struct trieNode* node, char* name, size_t length);
+void completeCommand(const char* prefix, size_t length);
+void completeFile(const char* word, size_t length);
+void insertCompletion(const char* text, size_t length);
+void showCompletions(void);
+int completeLine(int listing);
+int reverseSearch(char** line, size_t* capacity, size_t* length);
+ssize_t readLine(char** line, size_t* capacity);
+int openScript(const char* path);
+void openScriptString(const char* string);
+ssize_t fillScript(void);
+ssize_t readScriptLine(char** line, size_t* capacity);
+int exitCommand(char* args[]);
+int pwdCommand(char* args[]);
+int setCommand(char* args[]);
+void initJobs(void);
+unsigned int jobHash(pid_t pid);
+char* describePipeline(struct pipeline* pipeline);
+char* describeNode(struct node* node);
+struct job* findJob(const char* spec);
+struct job* addJob(pid_t pgid, pid_t pids[], int statuses[], int count, char* command);
+void removeJob(struct job* job);
+void forgetJobs(void);
+void updateProcess(pid_t pid, int status);
+void reapJobs(void);
+int jobStatus(struct job* job);
+void printJob(struct job* job);
+void notifyJobs(void);
+int waitJob(struct job* job);
+void signalJob(struct job* job, int signal);
+void continueJob(struct job* job);
+int jobsCommand(char* args[]);
+int fgCommand(char* args[]);
+int bgCommand(char* args[]);
+int waitCommand(char* args[]);
+int copyFile(int in, int out);
+int moveData(int in, int out);
+int writeAll(int fd, const char* data, size_t length);
+int teePipe(int in, int outputs[], int count);
+int catCommand(char* args[]);
+int teeCommand(char* args[]);
+char** parallelArguments(char* template[], int count, const char* argument);
+void freeArguments(char** argv);
+int launchParallelJob(struct parallelJob* job, char** argv, int devNull);
+int finishParallelJob(struct parallelJob* job);
+int parallelCommand(char* args[]);
+int trueCommand(char* args[]);
+int falseCommand(char* args[]);
+int helpCommand(char* args[]);
+int historyCommand(char* args[]);
+const struct builtin* findBuiltin(const char* name);
+int redirectionType(const char* token);
+int runBuiltin(const struct builtin* builtin, struct command* command);
+int commandHandler(struct command* command, int background);
+double elapsedSeconds(struct timespec* start, struct timespec* end);
+void measureShellStage(struct stageTime* time, int children);
+void reportTimes(struct pipeline* pipeline, struct stageTime times[], struct timespec* start);
+int measureShellCommand(struct pipeline* pipeline);
+void readProcessIo(pid_t pid, struct stageTime* time);
+int sizePipe(int fd);
+void reportPipeStats(struct pipeline* pipeline, struct stageTime times[], int capacities[]);
+int checkPipeSize(long size);
+int openTrace(const char* path);
+void closeTrace(void);
+void flushTrace(void);
+void beginTrace(const char* type);
+void endTrace(void);
+void tracePrintf(const char* format, ...);
+void traceString(const char* string);
+void tracePipeline(struct pipeline* pipeline, struct stageTime times[], int statuses[], struct timespec* start);
+void traceNode(struct node* node, int status, struct timespec* start);
+int traceCommand(char* args[]);
+int pipeHandler(struct pipeline* pipeline);
+int startsExpansion(char c);
+int isName(const char* word, size_t length);
+int isAssignment(const char* word);
+const char* expandVariable(const char* src, const char** value);
+char* describeMarkers(char* text);
+size_t captureOutput(int fd, char** buffer, size_t* capacity);
+char* substituteCommand(const char* text, size_t length);
+void appendWord(struct wordList* list, char* word);
+void expansionAppend(const char* text, size_t length);
+void endField(struct wordList* list, size_t start, int split);
+void expandWord(char* word, int split, struct wordList* list);
+char* expandString(char* word);
+struct pipeline* expandPipeline(struct pipeline* pipeline);
+char* restoreGlob(char* text);
+size_t compileClass(const char* text, size_t length, unsigned char* set);
+int compileComponent(const char* text, size_t length, struct globComponent* component);
+int globMatch(const struct globComponent* component, const char* name, size_t length);
+size_t appendPath(size_t pathLength, const char* name, size_t length);
+int entryIsDirectory(int fd, struct linuxDirent64* entry);
+void globComponents(struct globComponent* components, int index, int count, size_t pathLength, struct wordList* list);
+void globWord(char* word, struct wordList* list);
+void assignVariables(struct command* command);
+char** commandEnvironment(char** assignments);
+int exportCommand(char* args[]);
+int unsetCommand(char* args[]);
+void* arenaAlloc(struct arena* arena, size_t size);
+char* arenaStrdup(struct arena* arena, const char* string);
+void arenaReset(struct arena* arena);
+void syntaxError(struct parser* parser);
+struct node* newNode(int type, struct node* left, struct node* right);
+int closesList(struct parser* parser, char* token);
+int parseRedirection(struct parser* parser, struct redirection*** last);
+int parseCommand(struct parser* parser, struct command* command);
+struct node* parsePipeline(struct parser* parser);
+struct node* parseAndOr(struct parser* parser);
+struct node* parseList(struct parser* parser);
+struct node* parseIf(struct parser* parser);
+struct node* parseLine(char** tokens);
+int executeNode(struct node* node);
+int launchSubshell(struct node* node);
+int redirectShell(struct redirection* redirections, int saved[2]);
+void restoreShell(int saved[2]);
+int redirectionFlags(struct redirection* redirection, int* fd);
+int launchProg(struct command* command, int background);
+int isBuiltin(char* name);
+void initLexer();
+int isOperator(const char* token);
+char* lexOperator(char c, char next, int* length);
+void addToken(char* token);
+int tokenize(char* line);
+unsigned char* lexSubstitution(unsigned char* src, unsigned char** dst, char marker, char close);
+char* internKeyword(char* word, int length);
+unsigned int hashString(const char* string);
+void clearCommandTable();
+void forgetCommand(const char* name);
+char* searchPath(const char* name);
+const char* findCommand(const char* name);
+int hashCommand(char* args[]);
+int rehashCommand(char* args[]);
+void initSpawnAttr(struct spawnAttr* attr);
+int applyRedirections(struct spawnAttr* attr);
+void blockChildSignals(sigset_t* oldMask);
+pid_t forkProcess(struct spawnAttr* attr);
+pid_t spawnPosix(const char* path, char* args[], char* envp[], struct spawnAttr* attr);
+struct variable* findVariable(const char* name);
+const char* getVariable(const char* name);
+void setVariable(const char* name, const char* value, int exported);
+void unsetVariable(const char* name);
+char** buildEnvironment(void);
+void initVariables(char** envp);
+void updateDirectory(void);
+pid_t spawnProcess(char* args[], struct spawnAttr* attr);
+int exitStatus(int status);
+int decodeStatus(int status);
+int spawnFailureStatus(int error);
+int waitForeground(pid_t pids[], int count, pid_t pgid, int statuses[], struct pipeline* pipeline,
+	struct stageTime times[]);
+int pipelineStatus(int statuses[], int count);
+int spawnStatCommand(char* args[]);
+void executeStage(struct command* command);
+int runBuiltinStage(const struct builtin* builtin, struct command* command, int inFd, int outFd);
+int launchPipeline(struct pipeline* pipeline);